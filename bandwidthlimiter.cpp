@@ -0,0 +1,179 @@
+/**
+ * @file bandwidthlimiter.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Keeps the crawl under a hard bandwidth cap with token buckets. The
+ *         body callbacks of every transfer report what they received and
+ *         wait here when a bucket is in debt, which slows down the reads of
+ *         that transfer without dropping anything. A bucket only holds a
+ *         fraction of a second of its rate so a quiet moment can not be saved
+ *         up for a burst past the cap. The bytes counted are the ones on the
+ *         wire, for a compressed response that is less than what the body
+ *         callbacks get after decoding, which is counted apart.
+ * 
+ *         There is one bucket for all the transfers (--bandwidth) and
+ *         optional caps for every host and every traffic class. The shares of
+ *         the classes are what each of them is assured of: a class that is
+ *         within its share may take bytes even when the total is in debt
+ *         because of the others, a class that is over its share only gets
+ *         what the total has spare. That way the pages keep their share while
+ *         the media use whatever is left, and the total still never goes past
+ *         the cap for longer than one read.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "bandwidthlimiter.h"
+#include <algorithm>
+#include <thread>
+
+using clock_type = chrono::steady_clock;
+
+// A bucket holds this much of its rate, but at least one read of libcurl
+static const double BURST_SECONDS = 0.05;
+static const double MIN_BURST = 16 << 10;
+
+// How long a waiting transfer sleeps at most before looking again
+static const double MAX_WAIT_SECONDS = 0.1;
+
+void token_bucket::configure(double rate) {
+    this->rate = rate;
+    capacity = max(rate * BURST_SECONDS, MIN_BURST);
+    tokens = capacity;
+    last = clock_type::now();
+}
+
+void token_bucket::refill(clock_type::time_point now) {
+    double elapsed = chrono::duration<double>(now - last).count();
+    tokens = min(capacity, tokens + elapsed * rate);
+    last = now;
+}
+
+bandwidth_limiter::bandwidth_limiter(): host_rate(0), bytes_received(0), window_bytes(0) {
+    for (int c = 0; c < 3; c++) {
+        class_bytes[c] = 0;
+        decoded_bytes[c] = 0;
+    }
+    started = window_start = clock_type::now();
+}
+
+/**
+ * @brief Sets the rates of the buckets, a rate of 0 leaves it unlimited.
+ * 
+ * @param bandwidth    Bytes per second of all the transfers together.
+ * @param shares       Share of the bandwidth every class is assured of.
+ * @param class_limits Bytes per second every class may use at most.
+ * @param host_limit   Bytes per second one host may use at most.
+ */
+void bandwidth_limiter::configure(unsigned long long bandwidth, const double shares[3],
+                                  const unsigned long long class_limits[3], unsigned long long host_limit) {
+    lock_guard<mutex> lock(buckets_mutex);
+    total.configure(bandwidth);
+    double share_sum = 0;
+    for (int i = 0; i < 3; i++) {
+        share_sum += max(0.0, shares[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        double share = share_sum > 0 ? max(0.0, shares[i]) / share_sum : 1.0 / 3;
+        assured[i].configure(bandwidth * share);
+        class_caps[i].configure(class_limits[i]);
+    }
+    host_rate = host_limit;
+    hosts.clear();
+    started = window_start = clock_type::now();
+}
+
+/**
+ * @brief Takes the bytes a transfer received from the buckets, waiting first
+ *        until the buckets it has to respect are out of debt. Called from the
+ *        body callbacks so the transfer reads no faster than allowed.
+ * 
+ * @param traffic The class of the transfer.
+ * @param host    The host the bytes came from.
+ * @param bytes   How many bytes were received.
+ */
+void bandwidth_limiter::consume(TrafficClass traffic, const string& host, size_t bytes) {
+    double wait;
+    while ((wait = try_consume(traffic, host, bytes)) > 0) {
+        this_thread::sleep_for(chrono::duration<double>(min(wait, MAX_WAIT_SECONDS)));
+    }
+}
+
+/**
+ * @brief Like consume but never waits, for the callbacks of the fetch engine
+ *        that pause their transfer instead.
+ * 
+ * @return double 0 if the bytes were taken, otherwise the seconds to wait
+ *         before trying again; nothing was taken then.
+ */
+double bandwidth_limiter::try_consume(TrafficClass traffic, const string& host, size_t bytes) {
+    int c = (int)traffic;
+    if (total.limited() || class_caps[c].limited() || host_rate > 0) {
+        lock_guard<mutex> lock(buckets_mutex);
+        clock_type::time_point now = clock_type::now();
+        vector<token_bucket*> caps;
+        if (class_caps[c].limited()) {
+            caps.push_back(&class_caps[c]);
+        }
+        if (host_rate > 0) {
+            auto it = hosts.find(host);
+            if (it == hosts.end()) {
+                it = hosts.emplace(host, token_bucket()).first;
+                it->second.configure(host_rate);
+            }
+            caps.push_back(&it->second);
+        }
+
+        double wait = 0;
+        for (token_bucket* cap : caps) {
+            cap->refill(now);
+            if (cap->tokens < 0) {
+                wait = max(wait, -cap->tokens / cap->rate);
+            }
+        }
+        if (total.limited()) {
+            total.refill(now);
+            assured[c].refill(now);
+            // Within its share a class does not wait for the others
+            bool within_share = assured[c].limited() && assured[c].tokens >= 0;
+            if (!within_share && total.tokens < 0) {
+                wait = max(wait, -total.tokens / total.rate);
+            }
+        }
+
+        if (wait > 0) {
+            return wait;
+        }
+        for (token_bucket* cap : caps) {
+            cap->tokens -= bytes;
+        }
+        if (total.limited()) {
+            total.tokens -= bytes;
+            assured[c].tokens -= bytes;
+        }
+    }
+
+    bytes_received += bytes;
+    class_bytes[c] += bytes;
+    lock_guard<mutex> lock(window_mutex);
+    window_bytes += bytes;
+    return 0;
+}
+
+/**
+ * @brief Reports the throughput since the last call and since the start.
+ * 
+ * @param current Set to bytes per second since the last call.
+ * @param average Set to bytes per second since the crawl started.
+ */
+void bandwidth_limiter::throughput(double& current, double& average) {
+    clock_type::time_point now = clock_type::now();
+    lock_guard<mutex> lock(window_mutex);
+    double window = chrono::duration<double>(now - window_start).count();
+    double elapsed = chrono::duration<double>(now - started).count();
+    current = window > 0 ? window_bytes / window : 0;
+    average = elapsed > 0 ? bytes_received / elapsed : 0;
+    window_bytes = 0;
+    window_start = now;
+}
@@ -0,0 +1,53 @@
+// bandwidthlimiter.h
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include "trafficclass.h"
+
+#ifndef _BANDWIDTHLIMITER_H_
+#define _BANDWIDTHLIMITER_H_
+
+using namespace std;
+
+// Bytes per second that fill up to a small burst, taken bytes may put it in debt
+struct token_bucket {
+    double rate = 0;
+    double capacity = 0;
+    double tokens = 0;
+    chrono::steady_clock::time_point last;
+    void configure(double rate);
+    void refill(chrono::steady_clock::time_point now);
+    bool limited() const { return rate > 0; }
+};
+
+class bandwidth_limiter {
+private:
+    token_bucket total;
+    token_bucket assured[3];
+    token_bucket class_caps[3];
+    double host_rate;
+    unordered_map<string, token_bucket> hosts;
+    mutex buckets_mutex;
+    atomic<unsigned long long> bytes_received;
+    atomic<unsigned long long> class_bytes[3];
+    atomic<unsigned long long> decoded_bytes[3];
+    chrono::steady_clock::time_point started;
+    chrono::steady_clock::time_point window_start;
+    unsigned long long window_bytes;
+    mutex window_mutex;
+public:
+    bandwidth_limiter();
+    void configure(unsigned long long bandwidth, const double shares[3],
+                   const unsigned long long class_limits[3], unsigned long long host_limit);
+    void consume(TrafficClass traffic, const string& host, size_t bytes);
+    double try_consume(TrafficClass traffic, const string& host, size_t bytes);
+    void throughput(double& current, double& average);
+    unsigned long long received(TrafficClass traffic) { return class_bytes[(int)traffic]; }
+    void add_decoded(TrafficClass traffic, size_t bytes) { decoded_bytes[(int)traffic] += bytes; }
+    unsigned long long decoded(TrafficClass traffic) { return decoded_bytes[(int)traffic]; }
+};
+
+#endif
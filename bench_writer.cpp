@@ -0,0 +1,98 @@
+/**
+ * @file bench_writer.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Benchmark of the output backends of the disk writer. It writes the
+ *         same synthetic crawl, many files of a given size fed in pieces the
+ *         size of a curl write callback, once with pwrite and once with
+ *         io_uring and prints how many files and megabytes per second each
+ *         backend managed. Every file is preallocated like a media file with
+ *         a Content-Length and renamed into place when closed.
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include "diskwriter.h"
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+namespace fs = filesystem;
+
+// libcurl hands over the body in pieces of at most this size
+static const size_t CHUNK_SIZE = 16 << 10;
+
+/**
+ * @brief Writes the workload with one backend and prints its throughput.
+ *
+ * @return true if every file was written.
+ */
+static bool run(const string& dir, bool use_uring, size_t files, size_t file_size,
+                size_t threads, bool durable) {
+    fs::remove_all(dir);
+    fs::create_directories(dir + "/tmp");
+    fs::create_directories(dir + "/out");
+
+    disk_writer writer;
+    bool backend_ok = writer.start(threads, 64 << 20, durable, 20, use_uring);
+    if (use_uring && !backend_ok) {
+        cout << "io_uring      not available, skipped" << endl;
+        writer.shutdown();
+        return true;
+    }
+
+    vector<char> chunk(CHUNK_SIZE, 'x');
+    atomic<size_t> failed(0);
+
+    auto begin = chrono::steady_clock::now();
+    for (size_t i = 0; i < files; i++) {
+        string name = to_string(i);
+        disk_file* file = writer.open(dir + "/tmp/" + name);
+        writer.preallocate(file, file_size);
+        for (size_t written = 0; written < file_size; written += CHUNK_SIZE) {
+            writer.write(file, chunk.data(), min(CHUNK_SIZE, file_size - written));
+        }
+        writer.close(file, dir + "/out/" + name, [&failed](bool ok) {
+            if (!ok) {
+                failed++;
+            }
+        });
+    }
+    writer.shutdown();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    double megabytes = (double)files * file_size / (1 << 20);
+    cout << (use_uring ? "io_uring " : "pwrite   ") << "     "
+         << files / seconds << " files/s, " << megabytes / seconds << " MB/s";
+    if (failed > 0) {
+        cout << ", " << failed << " files failed";
+    }
+    cout << endl;
+
+    fs::remove_all(dir);
+    return failed == 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 6) {
+        cerr << "Usage: " << argv[0] << " <scratch_dir> [files] [file_size] [threads] [durable]" << endl;
+        return 1;
+    }
+
+    string dir = argv[1];
+    size_t files = argc > 2 ? stoul(argv[2]) : 2000;
+    size_t file_size = argc > 3 ? stoul(argv[3]) : 256 << 10;
+    size_t threads = argc > 4 ? stoul(argv[4]) : 2;
+    bool durable = argc > 5 ? string(argv[5]) != "0" : false;
+
+    cout << files << " files of " << file_size << " bytes, " << threads << " writer threads"
+         << (durable ? ", durable" : "") << endl;
+
+    bool ok = run(dir, false, files, file_size, threads, durable);
+    ok = run(dir, true, files, file_size, threads, durable) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file bodylimits.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Caps on how large a response body may get. A page is kept in memory
+ *         until it is parsed, so a server that streams gigabytes of "HTML"
+ *         would take the whole process down with it; a media file fills the
+ *         disk instead and a probe only wastes bandwidth on a body that is
+ *         thrown away. The write callbacks ask how much of what arrived still
+ *         fits and abort the transfer when something does not, the transfer
+ *         is then marked as truncated. A cap of 0 means no cap.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "bodylimits.h"
+
+body_limits::body_limits(): limits{32ULL << 20, 0, 1ULL << 20}, truncated{{0}, {0}, {0}} {}
+
+void body_limits::configure(unsigned long long page_bytes, unsigned long long media_bytes,
+                            unsigned long long probe_bytes) {
+    limits[(int)BodyClass::PAGE] = page_bytes;
+    limits[(int)BodyClass::MEDIA] = media_bytes;
+    limits[(int)BodyClass::PROBE] = probe_bytes;
+}
+
+/**
+ * @brief How much of the bytes a write callback was handed fit under the cap.
+ * 
+ * @param body     The class of the body.
+ * @param received Bytes of the body received before these.
+ * @param bytes    Bytes handed to the callback.
+ * @return size_t  All of them if they fit, otherwise the part that does; the
+ *         transfer has to be aborted then.
+ */
+size_t body_limits::allowed(BodyClass body, unsigned long long received, size_t bytes) const {
+    unsigned long long cap = limit(body);
+    if (cap == 0 || received + bytes <= cap) {
+        return bytes;
+    }
+    return received >= cap ? 0 : (size_t)(cap - received);
+}
+
+/**
+ * @brief The command line option of a cap, for the log.
+ */
+string body_limits::option(BodyClass body) {
+    switch (body) {
+        case BodyClass::PAGE:
+            return "--max-page-bytes";
+        case BodyClass::MEDIA:
+            return "--max-media-bytes";
+        case BodyClass::PROBE:
+            return "--max-probe-bytes";
+    }
+    return "";
+}
@@ -0,0 +1,28 @@
+// bodylimits.h
+#include <string>
+#include <atomic>
+
+#ifndef _BODYLIMITS_H_
+#define _BODYLIMITS_H_
+
+using namespace std;
+
+// What a response body is downloaded for, each has its own cap
+enum class BodyClass { PAGE, MEDIA, PROBE };
+
+class body_limits {
+private:
+    unsigned long long limits[3];
+    atomic<long> truncated[3];
+public:
+    body_limits();
+    void configure(unsigned long long page_bytes, unsigned long long media_bytes,
+                   unsigned long long probe_bytes);
+    unsigned long long limit(BodyClass body) const { return limits[(int)body]; }
+    size_t allowed(BodyClass body, unsigned long long received, size_t bytes) const;
+    void record_truncated(BodyClass body) { truncated[(int)body]++; }
+    long truncated_count(BodyClass body) const { return truncated[(int)body]; }
+    static string option(BodyClass body);
+};
+
+#endif
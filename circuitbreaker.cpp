@@ -0,0 +1,228 @@
+/**
+ * @file circuitbreaker.cpp
+ * @author Faisal Abdelmonem
+ * @brief  A circuit breaker for every host so a host that is down does not
+ *         keep eating the time of the threads with full timeouts. After
+ *         --breaker-failures failed transfers in a row the breaker opens and
+ *         no transfer to the host is started; its pages and links wait in
+ *         the url manager and its media in their traffic class. After --breaker-open-seconds one transfer is let through
+ *         (half open): if it works the breaker closes and the host is crawled
+ *         as before, if it fails the breaker opens again for twice as long.
+ *         A host that fails --breaker-trips half open tries in a row is
+ *         taken as dead and all of its urls are dropped.
+ *         A host that answers with a Retry-After header is held the same
+ *         way until that time has passed, for at most --max-retry-after
+ *         seconds, so no thread sleeps through it.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "circuitbreaker.h"
+#include <algorithm>
+
+using clock_type = chrono::steady_clock;
+
+host_breakers::host_breakers(): failure_threshold(5), open_seconds(30), max_trips(3), max_hold(300),
+    opened(0), dead(0) {}
+
+void host_breakers::configure(int failure_threshold, double open_seconds, int max_trips, double max_hold) {
+    lock_guard<mutex> lock(breakers_mutex);
+    this->failure_threshold = max(1, failure_threshold);
+    this->open_seconds = max(0.0, open_seconds);
+    this->max_trips = max(1, max_trips);
+    this->max_hold = max(0.0, max_hold);
+}
+
+/**
+ * @brief Asks whether a transfer to the host may start. Every transfer that
+ *        was allowed has to be followed by a call to record, or by a call to
+ *        release if it never got to the host. Call this right before the
+ *        transfer, the half open transfer is taken here.
+ * 
+ * @param host The host as returned by url_host.
+ * @return Admission ALLOW, WAIT while the breaker is open, its half open
+ *         transfer is in flight or the host is held, DEAD once the host is
+ *         given up on.
+ */
+Admission host_breakers::admit(const string& host) {
+    lock_guard<mutex> lock(breakers_mutex);
+    breaker& state = hosts[host];
+    if (state.state != BreakerState::DEAD && clock_type::now() < state.held_until) {
+        return Admission::WAIT;
+    }
+    switch (state.state) {
+        case BreakerState::CLOSED:
+            return Admission::ALLOW;
+        case BreakerState::DEAD:
+            return Admission::DEAD;
+        case BreakerState::OPEN:
+            if (clock_type::now() < state.retry_at) {
+                return Admission::WAIT;
+            }
+            state.state = BreakerState::HALF_OPEN;
+            state.probing = true;
+            return Admission::ALLOW;
+        case BreakerState::HALF_OPEN:
+            if (state.probing) {
+                return Admission::WAIT;
+            }
+            state.probing = true;
+            return Admission::ALLOW;
+    }
+    return Admission::ALLOW;
+}
+
+/**
+ * @brief Tells what admit would answer without taking the half open
+ *        transfer, so a url can be put aside or handed to a thread that
+ *        admits it when its transfer starts.
+ * 
+ * @param host The host as returned by url_host.
+ * @return Admission ALLOW if admit would let a transfer through now.
+ */
+Admission host_breakers::check(const string& host) {
+    lock_guard<mutex> lock(breakers_mutex);
+    auto it = hosts.find(host);
+    if (it == hosts.end()) {
+        return Admission::ALLOW;
+    }
+    if (it->second.state != BreakerState::DEAD && clock_type::now() < it->second.held_until) {
+        return Admission::WAIT;
+    }
+    switch (it->second.state) {
+        case BreakerState::CLOSED:
+            return Admission::ALLOW;
+        case BreakerState::DEAD:
+            return Admission::DEAD;
+        case BreakerState::OPEN:
+            return clock_type::now() < it->second.retry_at ? Admission::WAIT : Admission::ALLOW;
+        case BreakerState::HALF_OPEN:
+            return it->second.probing ? Admission::WAIT : Admission::ALLOW;
+    }
+    return Admission::ALLOW;
+}
+
+/**
+ * @brief Records how a transfer to the host went.
+ * 
+ * @param host    The host of the transfer.
+ * @param success false if it failed in a way retry_policy::retryable
+ *                considers a problem of the host.
+ */
+void host_breakers::record(const string& host, bool success) {
+    lock_guard<mutex> lock(breakers_mutex);
+    breaker& state = hosts[host];
+    if (success) {
+        if (state.state != BreakerState::DEAD) {
+            // A Retry-After another transfer got still holds
+            clock_type::time_point held_until = state.held_until;
+            state = breaker();
+            state.held_until = held_until;
+        }
+        return;
+    }
+
+    state.failures++;
+    if (state.state == BreakerState::HALF_OPEN) {
+        state.probing = false;
+        if (state.trips >= max_trips) {
+            state.state = BreakerState::DEAD;
+            dead++;
+            return;
+        }
+        state.state = BreakerState::OPEN;
+        state.retry_at = clock_type::now() + chrono::duration_cast<clock_type::duration>(
+            chrono::duration<double>(open_seconds * (1 << min(state.trips, 20))));
+        state.trips++;
+    } else if (state.state == BreakerState::CLOSED && state.failures >= failure_threshold) {
+        state.state = BreakerState::OPEN;
+        state.retry_at = clock_type::now() + chrono::duration_cast<clock_type::duration>(
+            chrono::duration<double>(open_seconds));
+        state.trips = 1;
+        opened++;
+    }
+}
+
+/**
+ * @brief Gives back a transfer admit allowed that never reached the host,
+ *        because it failed on our side. The breaker stays as it is, only
+ *        its half open transfer can be taken again.
+ * 
+ * @param host The host of the transfer.
+ */
+void host_breakers::release(const string& host) {
+    lock_guard<mutex> lock(breakers_mutex);
+    auto it = hosts.find(host);
+    if (it != hosts.end() && it->second.state == BreakerState::HALF_OPEN) {
+        it->second.probing = false;
+    }
+}
+
+/**
+ * @brief Holds the host for the Retry-After of one of its responses, no
+ *        transfer is let through until then. Longer waits than
+ *        --max-retry-after are cut to it.
+ * 
+ * @param host    The host of the transfer.
+ * @param seconds The Retry-After of the response, 0 if it had none.
+ */
+void host_breakers::hold(const string& host, double seconds) {
+    lock_guard<mutex> lock(breakers_mutex);
+    seconds = min(seconds, max_hold);
+    if (seconds <= 0) {
+        return;
+    }
+    breaker& state = hosts[host];
+    state.held_until = max(state.held_until, clock_type::now() +
+        chrono::duration_cast<clock_type::duration>(chrono::duration<double>(seconds)));
+}
+
+bool host_breakers::is_closed(const string& host) {
+    lock_guard<mutex> lock(breakers_mutex);
+    auto it = hosts.find(host);
+    return it == hosts.end() || it->second.state == BreakerState::CLOSED;
+}
+
+/**
+ * @brief The earliest time an open breaker or a held host lets a transfer
+ *        through again, the url manager waits until then when only such
+ *        hosts are left.
+ */
+clock_type::time_point host_breakers::next_retry() {
+    lock_guard<mutex> lock(breakers_mutex);
+    clock_type::time_point now = clock_type::now();
+    clock_type::time_point next = clock_type::time_point::max();
+    for (const auto& item : hosts) {
+        if (item.second.state == BreakerState::OPEN) {
+            next = min(next, max(item.second.retry_at, item.second.held_until));
+        } else if (item.second.state == BreakerState::HALF_OPEN) {
+            // Its half open transfer is in flight, the result wakes us up
+            next = min(next, max(now + chrono::seconds(1), item.second.held_until));
+        } else if (item.second.state == BreakerState::CLOSED && now < item.second.held_until) {
+            next = min(next, item.second.held_until);
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief The earliest time the breaker of one host lets a transfer through,
+ *        a media file that has to wait for its host is put aside until then.
+ */
+clock_type::time_point host_breakers::next_retry(const string& host) {
+    lock_guard<mutex> lock(breakers_mutex);
+    auto it = hosts.find(host);
+    clock_type::time_point now = clock_type::now();
+    if (it == hosts.end()) {
+        return now;
+    }
+    if (it->second.state == BreakerState::OPEN) {
+        return max(it->second.retry_at, it->second.held_until);
+    }
+    if (it->second.state == BreakerState::HALF_OPEN && it->second.probing) {
+        return max(now + chrono::seconds(1), it->second.held_until);
+    }
+    return max(now, it->second.held_until);
+}
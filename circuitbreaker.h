@@ -0,0 +1,51 @@
+// circuitbreaker.h
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+
+#ifndef _CIRCUITBREAKER_H_
+#define _CIRCUITBREAKER_H_
+
+using namespace std;
+
+enum class BreakerState { CLOSED, OPEN, HALF_OPEN, DEAD };
+
+// Whether a transfer to a host may start now
+enum class Admission { ALLOW, WAIT, DEAD };
+
+class host_breakers {
+private:
+    struct breaker {
+        BreakerState state = BreakerState::CLOSED;
+        int failures = 0;
+        int trips = 0;
+        bool probing = false;
+        chrono::steady_clock::time_point retry_at;
+        chrono::steady_clock::time_point held_until;
+    };
+    unordered_map<string, breaker> hosts;
+    mutex breakers_mutex;
+    int failure_threshold;
+    double open_seconds;
+    int max_trips;
+    double max_hold;
+    atomic<long> opened;
+    atomic<long> dead;
+public:
+    host_breakers();
+    void configure(int failure_threshold, double open_seconds, int max_trips, double max_hold);
+    Admission admit(const string& host);
+    Admission check(const string& host);
+    void record(const string& host, bool success);
+    void release(const string& host);
+    void hold(const string& host, double seconds);
+    bool is_closed(const string& host);
+    chrono::steady_clock::time_point next_retry();
+    chrono::steady_clock::time_point next_retry(const string& host);
+    long opened_count() { return opened; }
+    long dead_count() { return dead; }
+};
+
+#endif
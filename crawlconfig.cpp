@@ -0,0 +1,203 @@
+/**
+ * @file crawlconfig.cpp
+ * @author Faisal Abdelmonem
+ * @brief  The tunable knobs of the crawler. Every field has a default so
+ *         running it with only the json file works; the defaults are what
+ *         the README lists, which turns on compression, HTTP/2 multiplexing,
+ *         redirects, the 32 MiB page cap and the type predictor. The main
+ *         function passes any "--name=value" argument to set.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "crawlconfig.h"
+#include <stdexcept>
+
+/**
+ * @brief Parses a switch, giving the option without a value turns it on.
+ */
+static bool parse_bool(const string& value) {
+    if (value.empty() || value == "1" || value == "true" || value == "yes" || value == "on") {
+        return true;
+    }
+    if (value == "0" || value == "false" || value == "no" || value == "off") {
+        return false;
+    }
+    throw invalid_argument(value);
+}
+
+/**
+ * @brief Parses a size or a count. stoull takes "-1" and wraps it around to
+ *        the largest value, so a minus sign is refused here instead.
+ */
+static unsigned long long parse_unsigned(const string& value) {
+    size_t start = value.find_first_not_of(" \t\n\v\f\r");
+    if (start != string::npos && value[start] == '-') {
+        throw invalid_argument(value);
+    }
+    return stoull(value);
+}
+
+/**
+ * @brief Sets the option with the given name from its command line value.
+ * 
+ * @param name  Name of the option without the leading "--".
+ * @param value The value given after the '='.
+ * @return true if the option exists and the value could be parsed.
+ * @return false otherwise.
+ */
+bool crawl_config::set(const string& name, const string& value) {
+    try {
+        if (name == "threads") {
+            downloader_threads = stoi(value);
+        } else if (name == "parallel-probes") {
+            max_parallel_probes = stoi(value);
+        } else if (name == "predict-types") {
+            predict_types = parse_bool(value);
+        } else if (name == "predictor-samples") {
+            predictor_min_samples = stoi(value);
+        } else if (name == "predictor-confidence") {
+            predictor_confidence = stod(value);
+        } else if (name == "probe-cache-size") {
+            probe_cache_size = parse_unsigned(value);
+        } else if (name == "probe-cache-ttl") {
+            probe_cache_ttl = stol(value);
+        } else if (name == "probe-negative-ttl") {
+            probe_negative_ttl = stol(value);
+        } else if (name == "probe-cache-file") {
+            probe_cache_file = value;
+        } else if (name == "text-output") {
+            if (value != "files" && value != "pack") {
+                return false;
+            }
+            text_output = value;
+        } else if (name == "text-layout") {
+            if (value != "sharded" && value != "flat") {
+                return false;
+            }
+            text_layout = value;
+        } else if (name == "shard-depth") {
+            shard_depth = stoi(value);
+        } else if (name == "pack-segment-size") {
+            pack_segment_size = parse_unsigned(value);
+        } else if (name == "warc-dir") {
+            warc_directory = value;
+        } else if (name == "warc-compression") {
+            if (value == "gzip") {
+                warc_compression = WarcCompression::GZIP;
+            } else if (value == "zstd") {
+#ifndef HAVE_ZSTD
+                // Not compiled in, the crawl would run without its archive
+                return false;
+#endif
+                warc_compression = WarcCompression::ZSTD;
+            } else if (value == "none") {
+                warc_compression = WarcCompression::NONE;
+            } else {
+                return false;
+            }
+        } else if (name == "warc-segment-size") {
+            warc_segment_size = parse_unsigned(value);
+        } else if (name == "writer-threads") {
+            writer_threads = parse_unsigned(value);
+        } else if (name == "writer-memory") {
+            writer_memory = parse_unsigned(value);
+        } else if (name == "durable-writes") {
+            durable_writes = parse_bool(value);
+        } else if (name == "group-commit-ms") {
+            group_commit_ms = stoi(value);
+        } else if (name == "writer-backend") {
+            if (value != "pwrite" && value != "io_uring") {
+                return false;
+            }
+            writer_backend = value;
+        } else if (name == "host-connections") {
+            host_connections = stoi(value);
+        } else if (name == "host-initial-connections") {
+            host_initial_connections = stoi(value);
+        } else if (name == "range-threshold") {
+            range_threshold = parse_unsigned(value);
+        } else if (name == "range-parts") {
+            range_parts = stoi(value);
+        } else if (name == "asset-threads") {
+            asset_threads = stoi(value);
+        } else if (name == "media-threads") {
+            media_threads = stoi(value);
+        } else if (name == "large-media-size") {
+            large_media_size = parse_unsigned(value);
+        } else if (name == "bandwidth") {
+            bandwidth = parse_unsigned(value);
+        } else if (name == "html-share") {
+            html_share = stod(value);
+        } else if (name == "asset-share") {
+            asset_share = stod(value);
+        } else if (name == "media-share") {
+            media_share = stod(value);
+        } else if (name == "html-bandwidth") {
+            html_bandwidth = parse_unsigned(value);
+        } else if (name == "asset-bandwidth") {
+            asset_bandwidth = parse_unsigned(value);
+        } else if (name == "media-bandwidth") {
+            media_bandwidth = parse_unsigned(value);
+        } else if (name == "host-bandwidth") {
+            host_bandwidth = parse_unsigned(value);
+        } else if (name == "stats-interval") {
+            stats_interval = stoi(value);
+        } else if (name == "retries") {
+            retries = stoi(value);
+        } else if (name == "retry-base-ms") {
+            retry_base_ms = stoi(value);
+        } else if (name == "retry-max-ms") {
+            retry_max_ms = stoi(value);
+        } else if (name == "breaker-failures") {
+            breaker_failures = stoi(value);
+        } else if (name == "breaker-open-seconds") {
+            breaker_open_seconds = stod(value);
+        } else if (name == "breaker-trips") {
+            breaker_trips = stoi(value);
+        } else if (name == "max-retry-after") {
+            max_retry_after = stod(value);
+        } else if (name == "share-caches") {
+            share_caches = parse_bool(value);
+        } else if (name == "dns-threads") {
+            dns_threads = stoi(value);
+        } else if (name == "dns-ttl") {
+            dns_ttl = stod(value);
+        } else if (name == "dns-negative-ttl") {
+            dns_negative_ttl = stod(value);
+        } else if (name == "compression") {
+            compression = parse_bool(value);
+        } else if (name == "recrawl-file") {
+            recrawl_file = value;
+        } else if (name == "http-cache-dir") {
+            http_cache_dir = value;
+        } else if (name == "http-cache-size") {
+            http_cache_size = parse_unsigned(value);
+        } else if (name == "max-redirects") {
+            max_redirects = stoi(value);
+        } else if (name == "redirect-file") {
+            redirect_file = value;
+        } else if (name == "hsts-file") {
+            hsts_file = value;
+        } else if (name == "multiplex") {
+            multiplex = parse_bool(value);
+        } else if (name == "streams-per-connection") {
+            streams_per_connection = stoi(value);
+        } else if (name == "connections-per-host") {
+            connections_per_host = stoi(value);
+        } else if (name == "max-page-bytes") {
+            max_page_bytes = parse_unsigned(value);
+        } else if (name == "max-media-bytes") {
+            max_media_bytes = parse_unsigned(value);
+        } else if (name == "max-probe-bytes") {
+            max_probe_bytes = parse_unsigned(value);
+        } else {
+            return false;
+        }
+    } catch (const exception&) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+// crawlconfig.h
+#include <string>
+#include "warcwriter.h"
+
+#ifndef _CRAWLCONFIG_H_
+#define _CRAWLCONFIG_H_
+
+using namespace std;
+
+struct crawl_config {
+    int downloader_threads = 4;
+    int max_parallel_probes = 8;
+    bool predict_types = true;
+    int predictor_min_samples = 3;
+    double predictor_confidence = 0.9;
+    size_t probe_cache_size = 100000;
+    long probe_cache_ttl = 86400;
+    long probe_negative_ttl = 3600;
+    string probe_cache_file;
+    string text_output = "files";
+    string text_layout = "flat";
+    int shard_depth = 2;
+    unsigned long long pack_segment_size = 1ULL << 30;
+    string warc_directory;
+    WarcCompression warc_compression = WarcCompression::GZIP;
+    unsigned long long warc_segment_size = 1ULL << 30;
+    size_t writer_threads = 2;
+    size_t writer_memory = 64 << 20;
+    bool durable_writes = false;
+    int group_commit_ms = 20;
+    string writer_backend = "pwrite";
+    int host_connections = 6;
+    int host_initial_connections = 2;
+    unsigned long long range_threshold = 8ULL << 20;
+    int range_parts = 4;
+    int asset_threads = 4;
+    int media_threads = 2;
+    unsigned long long large_media_size = 4ULL << 20;
+    unsigned long long bandwidth = 0;
+    double html_share = 0.6;
+    double asset_share = 0.3;
+    double media_share = 0.1;
+    unsigned long long html_bandwidth = 0;
+    unsigned long long asset_bandwidth = 0;
+    unsigned long long media_bandwidth = 0;
+    unsigned long long host_bandwidth = 0;
+    int stats_interval = 10;
+    int retries = 3;
+    int retry_base_ms = 500;
+    int retry_max_ms = 30000;
+    int breaker_failures = 5;
+    double breaker_open_seconds = 30;
+    int breaker_trips = 3;
+    double max_retry_after = 300;
+    bool share_caches = true;
+    int dns_threads = 4;
+    double dns_ttl = 300;
+    double dns_negative_ttl = 60;
+    bool compression = true;
+    string recrawl_file;
+    string http_cache_dir;
+    unsigned long long http_cache_size = 1ULL << 30;
+    int max_redirects = 5;
+    string redirect_file;
+    string hsts_file;
+    bool multiplex = true;
+    int streams_per_connection = 100;
+    int connections_per_host = 0;
+    unsigned long long max_page_bytes = 32ULL << 20;
+    unsigned long long max_media_bytes = 0;
+    unsigned long long max_probe_bytes = 1ULL << 20;
+
+    bool set(const string& name, const string& value);
+};
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file curlshare.cpp
+ * @author Faisal Abdelmonem
+ * @brief  The caches libcurl keeps, shared by all the transfers of the crawl.
+ *         Every transfer gets a handle of its own and a handle forgets its
+ *         DNS answers, TLS sessions and open connections when it is cleaned
+ *         up, so without this every request resolved its host, connected
+ *         and did a full TLS handshake again. Attached to the share the
+ *         handles of all the threads see the same DNS cache, resume the TLS
+ *         sessions of each other and use one public suffix list. The pool
+ *         of idle connections is only shared when every transfer runs on the
+ *         fetch engine thread, libcurl does not support handles of several
+ *         threads using the same connections at once. libcurl locks the
+ *         share around every access; each kind of data has a lock of its own
+ *         so the threads only wait for each other when they touch the same
+ *         cache.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "curlshare.h"
+
+curl_share::curl_share(): share(nullptr), transfers(0), reused(0) {}
+
+curl_share::~curl_share() {
+    close();
+}
+
+void curl_share::lock(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr) {
+    (void)curl;
+    (void)access;
+    static_cast<curl_share*>(userptr)->locks[data].lock();
+}
+
+void curl_share::unlock(CURL* curl, curl_lock_data data, void* userptr) {
+    (void)curl;
+    static_cast<curl_share*>(userptr)->locks[data].unlock();
+}
+
+/**
+ * @brief Creates the share. curl_global_init must have been called.
+ * 
+ * @param connections Share the idle connections too, only when all the
+ *                    transfers are performed by one thread.
+ * @return true if the share is ready.
+ * @return false if libcurl could not create it, the handles then keep
+ *         caches of their own.
+ */
+bool curl_share::open(bool connections) {
+    share = curl_share_init();
+    if (!share) {
+        return false;
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_PSL);
+    if (connections) {
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    return true;
+}
+
+/**
+ * @brief Lets a new handle use the shared caches.
+ */
+void curl_share::attach(CURL* curl) {
+    if (share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
+}
+
+/**
+ * @brief Counts a finished transfer and whether it needed a new connection.
+ */
+void curl_share::record(CURL* curl) {
+    long connects = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK) {
+        transfers++;
+        if (connects == 0) {
+            reused++;
+        }
+    }
+}
+
+/**
+ * @brief Frees the share, no handle may be attached to it anymore.
+ */
+void curl_share::close() {
+    if (share) {
+        curl_share_cleanup(share);
+        share = nullptr;
+    }
+}
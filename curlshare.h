@@ -0,0 +1,34 @@
+// curlshare.h
+#include <mutex>
+#include <atomic>
+#include <curl/curl.h>
+
+#ifndef _CURLSHARE_H_
+#define _CURLSHARE_H_
+
+using namespace std;
+
+class curl_share {
+private:
+    CURLSH* share;
+    // One lock for every kind of data, so a thread resolving a host does
+    // not wait for one that is looking up a connection
+    mutex locks[CURL_LOCK_DATA_LAST];
+    atomic<long> transfers;
+    atomic<long> reused;
+    static void lock(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void unlock(CURL* curl, curl_lock_data data, void* userptr);
+public:
+    curl_share();
+    ~curl_share();
+    bool open(bool connections);
+    void attach(CURL* curl);
+    void record(CURL* curl);
+    void close();
+    long transfer_count() { return transfers; }
+    long reused_count() { return reused; }
+    curl_share(const curl_share&) = delete;
+    curl_share& operator=(const curl_share&) = delete;
+};
+
+#endif
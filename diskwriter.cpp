@@ -0,0 +1,620 @@
+/**
+ * @file diskwriter.cpp
+ * @author Faisal Abdelmonem
+ * @brief  A pool of threads that does all the writing to disk so the threads
+ *         that talk to the network never wait for it. A downloader opens a
+ *         file, hands over what it receives and closes it, and all of that
+ *         only puts a job in a queue. Small writes are first gathered in a
+ *         staging buffer of the file and handed over in larger pieces. The
+ *         memory of the buffers waiting to be written is limited, once the
+ *         budget is used up the network threads wait for the disk instead
+ *         of growing without a bound. A thread that must not wait, like the
+ *         fetch engine thread, asks has_room first and pauses its transfer
+ *         instead. All the jobs of one file go to the same writer thread so
+ *         they are done in order.
+ *
+ *         Files are written under a temporary name and renamed to their
+ *         final name when they are closed, so a half written file never
+ *         shows up under the final name. When durable writes are on, closed
+ *         files are not renamed right away: they are collected by a commit
+ *         thread that every few milliseconds syncs the whole group, renames
+ *         them and syncs their directories once, and only then reports them
+ *         as done (group commit). One slow sync is shared by many files
+ *         instead of every file paying for its own.
+ *
+ *         The writer threads write with pwrite at the offset they track for
+ *         every file. When built with liburing (-DHAVE_LIBURING) they can use
+ *         io_uring instead: every time a writer thread wakes up it takes all
+ *         of its queued jobs, copies the data of the writes into buffers that
+ *         are registered with the ring and submits them together, so a batch
+ *         of writes costs one system call. If the ring cannot be set up the
+ *         thread falls back to pwrite. Either way, when the size of a file is
+ *         known up front (from Content-Length) the space is preallocated with
+ *         fallocate so a large file is not fragmented while it grows.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "diskwriter.h"
+#include <filesystem>
+#include <set>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace fs = filesystem;
+
+// Writes smaller than this are gathered before they are handed to a writer thread
+static const size_t STAGING_SIZE = 64 << 10;
+
+// A group is committed early when this many files are waiting
+static const size_t MAX_GROUP_SIZE = 256;
+
+// Registered buffers of every io_uring writer thread and the size of each
+static const unsigned URING_BUFFERS = 32;
+static const size_t URING_BUFFER_SIZE = 64 << 10;
+
+#ifdef HAVE_LIBURING
+// One write that was submitted to the ring and is waiting for its completion
+struct uring_write_op {
+    disk_file* file;
+    unsigned buffer;
+    size_t size;
+    unsigned long long offset;
+};
+
+struct disk_writer::uring_state {
+    io_uring ring;
+    vector<char*> buffers;
+    vector<unsigned> free_buffers;
+    vector<uring_write_op> ops;
+    unsigned in_flight = 0;
+};
+#else
+struct disk_writer::uring_state {};
+#endif
+
+/**
+ * @brief Construct a new disk_writer object, start has to be called before
+ *        it is used.
+ */
+disk_writer::disk_writer(): memory_budget(0), memory_used(0), durable(false), group_commit_ms(0),
+    next_worker(0), use_uring(false), stopping_workers(false), stopping_commits(false), running(false) {}
+
+disk_writer::~disk_writer() {
+    shutdown();
+}
+
+/**
+ * @brief Starts the writer threads and the commit thread.
+ * 
+ * @param threads         How many threads write to disk.
+ * @param memory_budget   Bytes of buffers that may wait to be written.
+ * @param durable         Whether closed files are synced before being renamed.
+ * @param group_commit_ms How long the commit thread gathers closed files.
+ * @param use_uring       Write with io_uring instead of pwrite.
+ * @return true if the writers use the backend that was asked for.
+ * @return false if io_uring was asked for but is not available.
+ */
+bool disk_writer::start(size_t threads, size_t memory_budget, bool durable, int group_commit_ms, bool use_uring) {
+    this->memory_budget = memory_budget;
+    this->durable = durable;
+    this->group_commit_ms = group_commit_ms;
+    running = true;
+
+    bool backend_ok = true;
+    for (size_t i = 0; i < max((size_t)1, threads); i++) {
+        worker_queue* queue = new worker_queue();
+        if (use_uring && !uring_init(queue)) {
+            backend_ok = false;
+        }
+        queue->worker_thread = thread(&disk_writer::work, this, queue);
+        workers.emplace_back(queue);
+    }
+    commit_thread = thread(&disk_writer::commit_loop, this);
+    return backend_ok;
+}
+
+void disk_writer::enqueue(disk_file* file, JobType type, vector<char>&& data, unsigned long long size,
+                          bool wait) {
+    if (!data.empty()) {
+        unique_lock<mutex> lock(memory_mutex);
+        // A single buffer larger than the budget is let through when nothing
+        // else is waiting, otherwise it would wait forever
+        if (wait) {
+            memory_cv.wait(lock, [&]() {
+                return memory_used == 0 || memory_used + data.size() <= memory_budget;
+            });
+        }
+        memory_used += data.size();
+    }
+
+    worker_queue* queue = workers[file->worker];
+    {
+        lock_guard<mutex> lock(queue->queue_mutex);
+        queue->jobs.push_back(job{type, file, move(data), size});
+    }
+    queue->queue_cv.notify_one();
+}
+
+void disk_writer::flush_staging(disk_file* file, bool wait) {
+    if (!file->staging.empty()) {
+        vector<char> data;
+        data.swap(file->staging);
+        enqueue(file, JobType::WRITE, move(data), 0, wait);
+    }
+}
+
+/**
+ * @brief Opens a file for writing. The file is created by a writer thread,
+ *        this only queues the request.
+ * 
+ * @param path   The path the data is written to.
+ * @param append Keep what is in the file already instead of truncating it.
+ * @param near   Another file whose jobs this file's jobs must stay in order
+ *               with, or null to let the writer pick a thread.
+ * @return disk_file* The file to pass to write and close.
+ */
+disk_file* disk_writer::open(const string& path, bool append, const disk_file* near) {
+    disk_file* file = new disk_file();
+    file->path = path;
+    file->append = append;
+    file->worker = near ? near->worker : next_worker++ % workers.size();
+    enqueue(file, JobType::OPEN, vector<char>());
+    return file;
+}
+
+/**
+ * @brief Opens an existing file to write a part of it, starting at the given
+ *        offset. Nothing else in the file is touched, several parts of one
+ *        file can be written at the same time.
+ * 
+ * @param path   The file, created if it is not there.
+ * @param offset Where the first byte handed over is written.
+ * @return disk_file* The file to pass to write and close.
+ */
+disk_file* disk_writer::open_at(const string& path, unsigned long long offset) {
+    disk_file* file = new disk_file();
+    file->path = path;
+    file->positioned = true;
+    file->offset = offset;
+    file->worker = next_worker++ % workers.size();
+    enqueue(file, JobType::OPEN, vector<char>());
+    return file;
+}
+
+/**
+ * @brief Reserves space for a file whose final size is known, like a media
+ *        file with a Content-Length. The file is cut to what was actually
+ *        written when it is closed.
+ */
+void disk_writer::preallocate(disk_file* file, unsigned long long size) {
+    flush_staging(file);
+    enqueue(file, JobType::PREALLOCATE, vector<char>(), size);
+}
+
+/**
+ * @brief Tells whether handing over this many bytes now would be let through
+ *        without waiting for the writers.
+ */
+bool disk_writer::has_room(size_t size) {
+    lock_guard<mutex> lock(memory_mutex);
+    return memory_used == 0 || memory_used + size <= memory_budget;
+}
+
+/**
+ * @brief Hands over data to be appended to the file. The staging buffer of
+ *        the file is not locked, so the writes to one file have to be
+ *        serialized by the caller (the WARC and pack segments shared by all
+ *        downloaders are written under warc_mutex and pack_mutex).
+ * 
+ * @param wait false to go over the memory budget instead of waiting for it,
+ *             for a caller that checked has_room and must not block.
+ */
+void disk_writer::write(disk_file* file, const void* data, size_t size, bool wait) {
+    const char* bytes = (const char*)data;
+    if (size >= STAGING_SIZE) {
+        flush_staging(file, wait);
+        enqueue(file, JobType::WRITE, vector<char>(bytes, bytes + size), 0, wait);
+        return;
+    }
+    file->staging.insert(file->staging.end(), bytes, bytes + size);
+    if (file->staging.size() >= STAGING_SIZE) {
+        flush_staging(file, wait);
+    }
+}
+
+/**
+ * @brief Hands over what is gathered in the staging buffer of the file right
+ *        away, so it is written before anything handed over after this call.
+ */
+void disk_writer::flush(disk_file* file) {
+    flush_staging(file);
+}
+
+/**
+ * @brief Closes the file once everything handed over is written.
+ * 
+ * @param file      The file to close, it must not be used afterwards.
+ * @param rename_to The final name of the file, or empty to keep its path.
+ * @param done      Called from a writer thread with whether the file made
+ *                  it to disk under its final name.
+ */
+void disk_writer::close(disk_file* file, const string& rename_to, function<void(bool)> done) {
+    flush_staging(file);
+    file->rename_to = rename_to;
+    file->done = done;
+    enqueue(file, JobType::CLOSE, vector<char>());
+}
+
+/**
+ * @brief Closes the file and removes it, whatever was written is dropped.
+ */
+void disk_writer::discard(disk_file* file) {
+    file->staging.clear();
+    enqueue(file, JobType::DISCARD, vector<char>());
+}
+
+void disk_writer::finish(disk_file* file, bool ok) {
+    if (file->done) {
+        file->done(ok);
+    }
+    delete file;
+}
+
+void disk_writer::release_memory(size_t size) {
+    if (size == 0) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(memory_mutex);
+        memory_used -= size;
+    }
+    memory_cv.notify_all();
+}
+
+/**
+ * @brief Does one job with plain system calls, this is every job of the
+ *        pwrite backend and every job but the writes of the io_uring one.
+ */
+void disk_writer::run_job(job& next) {
+    disk_file* file = next.file;
+    switch (next.type) {
+        case JobType::OPEN:
+            file->fd = ::open(file->path.c_str(),
+                              O_WRONLY | O_CREAT | O_CLOEXEC | (file->append || file->positioned ? 0 : O_TRUNC),
+                              0644);
+            file->failed = file->fd < 0;
+            if (!file->failed && file->append) {
+                file->offset = lseek(file->fd, 0, SEEK_END);
+            }
+            break;
+        case JobType::PREALLOCATE:
+            if (!file->failed && next.size > file->offset && fallocate(file->fd, 0, 0, next.size) == 0) {
+                file->preallocated = next.size;
+            }
+            break;
+        case JobType::WRITE: {
+            const char* data = next.data.data();
+            size_t size = next.data.size();
+            while (!file->failed && size > 0) {
+                ssize_t written = pwrite(file->fd, data, size, file->offset);
+                if (written < 0) {
+                    file->failed = true;
+                } else {
+                    data += written;
+                    size -= written;
+                    file->offset += written;
+                }
+            }
+            break;
+        }
+        case JobType::CLOSE:
+            // Give back the preallocated space the transfer did not use
+            if (!file->failed && file->preallocated > file->offset) {
+                file->failed = ftruncate(file->fd, file->offset) != 0;
+            }
+            if (durable && !file->failed) {
+                {
+                    lock_guard<mutex> lock(commit_mutex);
+                    commits.push_back(file);
+                }
+                commit_cv.notify_one();
+            } else {
+                if (file->fd >= 0) {
+                    ::close(file->fd);
+                }
+                bool ok = !file->failed;
+                if (ok && !file->rename_to.empty()) {
+                    error_code ec;
+                    fs::create_directories(fs::path(file->rename_to).parent_path(), ec);
+                    ok = ::rename(file->path.c_str(), file->rename_to.c_str()) == 0;
+                }
+                finish(file, ok);
+            }
+            break;
+        case JobType::DISCARD:
+            if (file->fd >= 0) {
+                ::close(file->fd);
+            }
+            ::unlink(file->path.c_str());
+            finish(file, false);
+            break;
+    }
+}
+
+void disk_writer::work(worker_queue* queue) {
+    while (true) {
+        deque<job> batch;
+        {
+            unique_lock<mutex> lock(queue->queue_mutex);
+            queue->queue_cv.wait(lock, [&]() { return stopping_workers || !queue->jobs.empty(); });
+            if (queue->jobs.empty()) {
+                break;
+            }
+            batch.swap(queue->jobs);
+        }
+
+        for (job& next : batch) {
+            size_t size = next.data.size();
+            if (queue->uring && next.type == JobType::WRITE) {
+                uring_write(queue, next);
+            } else {
+                // Everything else has to see the writes before it completed
+                if (queue->uring) {
+                    uring_wait(queue, true);
+                }
+                run_job(next);
+            }
+            release_memory(size);
+        }
+        if (queue->uring) {
+            uring_wait(queue, true);
+        }
+    }
+    uring_exit(queue);
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * @brief Sets up the ring of a writer thread and registers its buffers.
+ * 
+ * @return true if io_uring can be used.
+ * @return false if the kernel (or a seccomp policy) does not allow it.
+ */
+bool disk_writer::uring_init(worker_queue* queue) {
+    uring_state* uring = new uring_state();
+    if (io_uring_queue_init(URING_BUFFERS, &uring->ring, 0) != 0) {
+        delete uring;
+        return false;
+    }
+
+    vector<iovec> iovecs(URING_BUFFERS);
+    for (unsigned i = 0; i < URING_BUFFERS; i++) {
+        uring->buffers.push_back(new char[URING_BUFFER_SIZE]);
+        iovecs[i].iov_base = uring->buffers[i];
+        iovecs[i].iov_len = URING_BUFFER_SIZE;
+        uring->free_buffers.push_back(i);
+    }
+    uring->ops.resize(URING_BUFFERS);
+    if (io_uring_register_buffers(&uring->ring, iovecs.data(), iovecs.size()) != 0) {
+        io_uring_queue_exit(&uring->ring);
+        for (char* buffer : uring->buffers) {
+            delete[] buffer;
+        }
+        delete uring;
+        return false;
+    }
+
+    queue->uring = uring;
+    return true;
+}
+
+/**
+ * @brief Copies a write into registered buffers and queues it on the ring.
+ *        The writes are only submitted when the ring runs out of buffers or
+ *        when uring_wait is called at the end of the batch.
+ */
+void disk_writer::uring_write(worker_queue* queue, job& next) {
+    uring_state* uring = queue->uring;
+    disk_file* file = next.file;
+    const char* data = next.data.data();
+    size_t size = next.data.size();
+
+    while (!file->failed && size > 0) {
+        if (uring->free_buffers.empty()) {
+            uring_wait(queue, false);
+            if (!queue->uring) {
+                // The ring broke, the rest of this write goes through pwrite
+                next.data.erase(next.data.begin(), next.data.begin() + (data - next.data.data()));
+                run_job(next);
+                return;
+            }
+        }
+        unsigned buffer = uring->free_buffers.back();
+        uring->free_buffers.pop_back();
+
+        size_t chunk = min(size, URING_BUFFER_SIZE);
+        memcpy(uring->buffers[buffer], data, chunk);
+        uring->ops[buffer] = uring_write_op{file, buffer, chunk, file->offset};
+
+        io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+        io_uring_prep_write_fixed(sqe, file->fd, uring->buffers[buffer], chunk, file->offset, buffer);
+        io_uring_sqe_set_data(sqe, &uring->ops[buffer]);
+        uring->in_flight++;
+
+        file->offset += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief Submits the queued writes and reaps completions, either until one
+ *        buffer is free again or until nothing is in flight anymore. A
+ *        short write is finished with pwrite. If the ring itself fails the
+ *        files still in flight are marked failed and the thread goes back
+ *        to pwrite.
+ */
+void disk_writer::uring_wait(worker_queue* queue, bool all) {
+    uring_state* uring = queue->uring;
+    if (uring->in_flight == 0) {
+        return;
+    }
+
+    io_uring_submit(&uring->ring);
+    while (uring->in_flight > 0 && (all || uring->free_buffers.empty())) {
+        io_uring_cqe* cqe;
+        int error = io_uring_wait_cqe(&uring->ring, &cqe);
+        if (error == -EINTR) {
+            continue;
+        }
+        if (error != 0) {
+            vector<bool> idle(URING_BUFFERS, false);
+            for (unsigned buffer : uring->free_buffers) {
+                idle[buffer] = true;
+            }
+            for (unsigned buffer = 0; buffer < URING_BUFFERS; buffer++) {
+                if (!idle[buffer]) {
+                    uring->ops[buffer].file->failed = true;
+                }
+            }
+            uring_exit(queue);
+            break;
+        }
+        uring_write_op* op = (uring_write_op*)io_uring_cqe_get_data(cqe);
+        int result = cqe->res;
+        io_uring_cqe_seen(&uring->ring, cqe);
+
+        if (result < 0) {
+            op->file->failed = true;
+        } else if ((size_t)result < op->size) {
+            const char* rest = uring->buffers[op->buffer] + result;
+            size_t left = op->size - result;
+            unsigned long long offset = op->offset + result;
+            while (left > 0) {
+                ssize_t written = pwrite(op->file->fd, rest, left, offset);
+                if (written <= 0) {
+                    op->file->failed = true;
+                    break;
+                }
+                rest += written;
+                left -= written;
+                offset += written;
+            }
+        }
+        uring->free_buffers.push_back(op->buffer);
+        uring->in_flight--;
+    }
+}
+
+void disk_writer::uring_exit(worker_queue* queue) {
+    if (!queue->uring) {
+        return;
+    }
+    io_uring_queue_exit(&queue->uring->ring);
+    for (char* buffer : queue->uring->buffers) {
+        delete[] buffer;
+    }
+    delete queue->uring;
+    queue->uring = nullptr;
+}
+#else
+bool disk_writer::uring_init(worker_queue*) {
+    return false;
+}
+
+void disk_writer::uring_write(worker_queue*, job&) {}
+
+void disk_writer::uring_wait(worker_queue*, bool) {}
+
+void disk_writer::uring_exit(worker_queue*) {}
+#endif
+
+/**
+ * @brief The commit thread, it takes all the files closed in the last few
+ *        milliseconds, syncs them, renames them to their final names, syncs
+ *        the directories they ended up in and reports them as done.
+ */
+void disk_writer::commit_loop() {
+    while (true) {
+        deque<disk_file*> group;
+        {
+            unique_lock<mutex> lock(commit_mutex);
+            commit_cv.wait(lock, [&]() { return stopping_commits || !commits.empty(); });
+            if (commits.empty()) {
+                return;
+            }
+            // Let more files join the group unless it is already large
+            commit_cv.wait_for(lock, chrono::milliseconds(group_commit_ms), [&]() {
+                return stopping_commits || commits.size() >= MAX_GROUP_SIZE;
+            });
+            group.swap(commits);
+        }
+
+        set<string> directories;
+        vector<bool> ok(group.size(), true);
+        for (size_t i = 0; i < group.size(); i++) {
+            ok[i] = fdatasync(group[i]->fd) == 0;
+            ::close(group[i]->fd);
+        }
+        for (size_t i = 0; i < group.size(); i++) {
+            disk_file* file = group[i];
+            string final_path = file->rename_to.empty() ? file->path : file->rename_to;
+            if (ok[i] && !file->rename_to.empty()) {
+                error_code ec;
+                fs::create_directories(fs::path(file->rename_to).parent_path(), ec);
+                ok[i] = ::rename(file->path.c_str(), file->rename_to.c_str()) == 0;
+            }
+            directories.insert(fs::path(final_path).parent_path().string());
+        }
+        // The renames are only durable once their directories are synced
+        for (const string& directory : directories) {
+            int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd >= 0) {
+                fsync(fd);
+                ::close(fd);
+            }
+        }
+        for (size_t i = 0; i < group.size(); i++) {
+            finish(group[i], ok[i]);
+        }
+    }
+}
+
+/**
+ * @brief Writes out everything that is still queued and stops the threads.
+ */
+void disk_writer::shutdown() {
+    if (!running) {
+        return;
+    }
+
+    // The writer threads go first since they are the ones feeding the commit thread
+    for (worker_queue* queue : workers) {
+        {
+            lock_guard<mutex> lock(queue->queue_mutex);
+            stopping_workers = true;
+        }
+        queue->queue_cv.notify_all();
+    }
+    for (worker_queue* queue : workers) {
+        queue->worker_thread.join();
+        delete queue;
+    }
+    workers.clear();
+
+    {
+        lock_guard<mutex> lock(commit_mutex);
+        stopping_commits = true;
+    }
+    commit_cv.notify_all();
+    commit_thread.join();
+    running = false;
+}
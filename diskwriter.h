@@ -0,0 +1,90 @@
+// diskwriter.h
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#ifndef _DISKWRITER_H_
+#define _DISKWRITER_H_
+
+using namespace std;
+
+struct disk_file {
+    string path;
+    string rename_to;
+    int fd = -1;
+    bool append = false;
+    bool positioned = false;
+    bool failed = false;
+    unsigned long long offset = 0;
+    unsigned long long preallocated = 0;
+    size_t worker = 0;
+    vector<char> staging;
+    function<void(bool)> done;
+};
+
+class disk_writer {
+private:
+    enum class JobType { OPEN, PREALLOCATE, WRITE, CLOSE, DISCARD };
+    struct job {
+        JobType type;
+        disk_file* file;
+        vector<char> data;
+        unsigned long long size;
+    };
+    struct uring_state;
+    struct worker_queue {
+        deque<job> jobs;
+        mutex queue_mutex;
+        condition_variable queue_cv;
+        thread worker_thread;
+        uring_state* uring = nullptr;
+    };
+    vector<worker_queue*> workers;
+    deque<disk_file*> commits;
+    mutex commit_mutex;
+    condition_variable commit_cv;
+    thread commit_thread;
+    size_t memory_budget;
+    size_t memory_used;
+    mutex memory_mutex;
+    condition_variable memory_cv;
+    bool durable;
+    int group_commit_ms;
+    atomic<size_t> next_worker;
+    bool use_uring;
+    atomic<bool> stopping_workers;
+    atomic<bool> stopping_commits;
+    bool running;
+    void enqueue(disk_file* file, JobType type, vector<char>&& data, unsigned long long size = 0,
+                 bool wait = true);
+    void flush_staging(disk_file* file, bool wait = true);
+    void release_memory(size_t size);
+    void run_job(job& next);
+    bool uring_init(worker_queue* queue);
+    void uring_write(worker_queue* queue, job& next);
+    void uring_wait(worker_queue* queue, bool all);
+    void uring_exit(worker_queue* queue);
+    void work(worker_queue* queue);
+    void commit_loop();
+    void finish(disk_file* file, bool ok);
+public:
+    disk_writer();
+    ~disk_writer();
+    bool start(size_t threads, size_t memory_budget, bool durable, int group_commit_ms, bool use_uring = false);
+    disk_file* open(const string& path, bool append = false, const disk_file* near = nullptr);
+    disk_file* open_at(const string& path, unsigned long long offset);
+    void preallocate(disk_file* file, unsigned long long size);
+    bool has_room(size_t size);
+    void write(disk_file* file, const void* data, size_t size, bool wait = true);
+    void flush(disk_file* file);
+    void close(disk_file* file, const string& rename_to = "", function<void(bool)> done = nullptr);
+    void discard(disk_file* file);
+    void shutdown();
+};
+
+#endif
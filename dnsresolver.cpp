@@ -0,0 +1,270 @@
+/**
+ * @file dnsresolver.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Resolves the hosts of new urls before they are fetched. The names
+ *         of the links a page has are handed to a small pool of resolver
+ *         threads (--dns-threads) as soon as the page is parsed, so the
+ *         lookups of all the new hosts run at the same time and while the
+ *         threads are still busy with other transfers. When a transfer to
+ *         the host starts, its addresses are given to libcurl with
+ *         CURLOPT_RESOLVE and go into the shared DNS cache (see curlshare.cpp)
+ *         instead of being looked up on the spot. A transfer whose host is
+ *         still being resolved waits for that lookup rather than starting a
+ *         second one. Answers are kept for --dns-ttl seconds and names that
+ *         do not exist for --dns-negative-ttl seconds, their transfers fail
+ *         right away. Lookups that failed for another reason (a timeout of
+ *         the name server) are not kept.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "dnsresolver.h"
+#include "urlutil.h"
+#include <algorithm>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+using clock_type = chrono::steady_clock;
+
+// How long a transfer waits for the lookup of its host that is under way
+static const chrono::seconds RESOLVE_WAIT(5);
+
+/**
+ * @brief Splits the host of a url into its name and port.
+ * 
+ * @return false if the url is not http or https.
+ */
+static bool split_host(const string& url, string& name, long& port) {
+    size_t scheme_end = url.find("://");
+    if (scheme_end == string::npos) {
+        return false;
+    }
+    string scheme = url.substr(0, scheme_end);
+    transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+    if (scheme == "http") {
+        port = 80;
+    } else if (scheme == "https") {
+        port = 443;
+    } else {
+        return false;
+    }
+
+    string host = url_host(url);
+    size_t user_end = host.rfind('@');
+    if (user_end != string::npos) {
+        host = host.substr(user_end + 1);
+    }
+    size_t port_start = string::npos;
+    if (!host.empty() && host[0] == '[') {
+        size_t close = host.find(']');
+        if (close == string::npos) {
+            return false;
+        }
+        name = host.substr(1, close - 1);
+        if (close + 1 < host.size() && host[close + 1] == ':') {
+            port_start = close + 2;
+        }
+    } else {
+        size_t colon = host.rfind(':');
+        name = host.substr(0, colon);
+        if (colon != string::npos) {
+            port_start = colon + 1;
+        }
+    }
+    if (port_start != string::npos) {
+        try {
+            port = stol(host.substr(port_start));
+        } catch (const exception&) {
+            return false;
+        }
+    }
+    return !name.empty();
+}
+
+// A name that is an address already needs no lookup
+static bool is_address(const string& name) {
+    unsigned char buffer[sizeof(struct in6_addr)];
+    return inet_pton(AF_INET, name.c_str(), buffer) == 1 || inet_pton(AF_INET6, name.c_str(), buffer) == 1;
+}
+
+dns_resolver::dns_resolver(): stopping(false), ttl(300), negative_ttl(60), resolved(0), failed(0), warm(0) {}
+
+dns_resolver::~dns_resolver() {
+    stop();
+}
+
+/**
+ * @brief Starts the resolver threads.
+ * 
+ * @param threads      How many names are resolved at the same time, 0 turns
+ *                     the pre-resolution off.
+ * @param ttl          Seconds an answer is used.
+ * @param negative_ttl Seconds a name that does not exist is remembered.
+ */
+void dns_resolver::start(int threads, double ttl, double negative_ttl) {
+    this->ttl = ttl;
+    this->negative_ttl = negative_ttl;
+    stopping = false;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(&dns_resolver::run, this);
+    }
+}
+
+/**
+ * @brief Queues the host of the url for a lookup unless its answer is
+ *        known or already on the way.
+ */
+void dns_resolver::prefetch(const string& url) {
+    string name;
+    long port;
+    if (workers.empty() || !split_host(url, name, port) || is_address(name)) {
+        return;
+    }
+    lock_guard<mutex> lock(entries_mutex);
+    auto it = entries.find(name);
+    if (it != entries.end() && (!it->second.done || clock_type::now() < it->second.expires)) {
+        return;
+    }
+    entries[name] = dns_entry();
+    pending.push_back(name);
+    work_cv.notify_one();
+}
+
+/**
+ * @brief Gives the transfer the addresses of its host if they are known.
+ * 
+ * @param curl    The handle of the transfer.
+ * @param url     The url of the transfer.
+ * @param resolve The list set as CURLOPT_RESOLVE, the caller frees it with
+ *                curl_slist_free_all after the transfer.
+ * @return false if the host is known not to exist.
+ */
+bool dns_resolver::prepare(CURL* curl, const string& url, curl_slist*& resolve) {
+    string name;
+    long port;
+    if (workers.empty() || !split_host(url, name, port) || is_address(name)) {
+        return true;
+    }
+
+    unique_lock<mutex> lock(entries_mutex);
+    auto deadline = clock_type::now() + RESOLVE_WAIT;
+    auto it = entries.find(name);
+    while (it != entries.end() && !it->second.done) {
+        if (done_cv.wait_until(lock, deadline) == cv_status::timeout) {
+            return true;
+        }
+        it = entries.find(name);
+    }
+    // Never queued or the lookup failed, libcurl resolves it on its own
+    if (it == entries.end()) {
+        return true;
+    }
+    if (clock_type::now() >= it->second.expires) {
+        // Looked up again for the next transfers
+        it->second = dns_entry();
+        pending.push_back(name);
+        work_cv.notify_one();
+        return true;
+    }
+
+    warm++;
+    if (it->second.negative) {
+        return false;
+    }
+    string entry = "+" + name + ":" + to_string(port) + ":" + it->second.addresses;
+    resolve = curl_slist_append(resolve, entry.c_str());
+    curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve);
+    return true;
+}
+
+/**
+ * @brief Body of a resolver thread.
+ */
+void dns_resolver::run() {
+    unique_lock<mutex> lock(entries_mutex);
+    while (true) {
+        work_cv.wait(lock, [this]() { return stopping || !pending.empty(); });
+        if (stopping) {
+            return;
+        }
+        string name = pending.front();
+        pending.pop_front();
+        lock.unlock();
+        resolve(name);
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Looks up one name and stores the answer.
+ */
+void dns_resolver::resolve(const string& name) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    int error = getaddrinfo(name.c_str(), nullptr, &hints, &result);
+
+    vector<string> addresses;
+    for (struct addrinfo* info = result; error == 0 && info; info = info->ai_next) {
+        char text[INET6_ADDRSTRLEN];
+        string address;
+        if (info->ai_family == AF_INET &&
+            inet_ntop(AF_INET, &((struct sockaddr_in*)info->ai_addr)->sin_addr, text, sizeof(text))) {
+            address = text;
+        } else if (info->ai_family == AF_INET6 &&
+                   inet_ntop(AF_INET6, &((struct sockaddr_in6*)info->ai_addr)->sin6_addr, text, sizeof(text))) {
+            address = "[" + string(text) + "]";
+        }
+        if (!address.empty() && find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+            addresses.push_back(address);
+        }
+    }
+    if (result) {
+        freeaddrinfo(result);
+    }
+
+    bool negative = error == EAI_NONAME;
+#ifdef EAI_NODATA
+    negative = negative || error == EAI_NODATA;
+#endif
+
+    lock_guard<mutex> lock(entries_mutex);
+    if ((error != 0 || addresses.empty()) && !negative) {
+        entries.erase(name);
+        failed++;
+    } else {
+        dns_entry& entry = entries[name];
+        entry.done = true;
+        entry.negative = negative;
+        for (const string& address : addresses) {
+            entry.addresses += (entry.addresses.empty() ? "" : ",") + address;
+        }
+        entry.expires = clock_type::now() + chrono::duration_cast<clock_type::duration>(
+            chrono::duration<double>(negative ? negative_ttl : ttl));
+        if (negative) {
+            failed++;
+        } else {
+            resolved++;
+        }
+    }
+    done_cv.notify_all();
+}
+
+/**
+ * @brief Stops the resolver threads, the lookups still queued are dropped.
+ */
+void dns_resolver::stop() {
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
@@ -0,0 +1,52 @@
+// dnsresolver.h
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <curl/curl.h>
+
+#ifndef _DNSRESOLVER_H_
+#define _DNSRESOLVER_H_
+
+using namespace std;
+
+class dns_resolver {
+private:
+    struct dns_entry {
+        bool done = false;
+        bool negative = false;
+        string addresses;
+        chrono::steady_clock::time_point expires;
+    };
+    unordered_map<string, dns_entry> entries;
+    deque<string> pending;
+    vector<thread> workers;
+    mutex entries_mutex;
+    condition_variable work_cv;
+    condition_variable done_cv;
+    bool stopping;
+    double ttl;
+    double negative_ttl;
+    atomic<long> resolved;
+    atomic<long> failed;
+    atomic<long> warm;
+    void run();
+    void resolve(const string& name);
+public:
+    dns_resolver();
+    ~dns_resolver();
+    void start(int threads, double ttl, double negative_ttl);
+    void prefetch(const string& url);
+    bool prepare(CURL* curl, const string& url, curl_slist*& resolve);
+    void stop();
+    long resolved_count() { return resolved; }
+    long failed_count() { return failed; }
+    long warm_count() { return warm; }
+};
+
+#endif
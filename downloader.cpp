@@ -26,6 +26,15 @@
  */
 
 #include "downloader.h"
+#include "urlutil.h"
+#include <atomic>
+#include <sstream>
+#include <memory>
+#include <future>
+#include <filesystem>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /**
  * @brief Construct a new downloader::downloader object, here we
@@ -34,8 +43,11 @@
  *        thread and detach it.
  * 
  * @param urlmanager 
+ * @param traffic    HTML for a thread crawling pages, ASSETS or MEDIA for a
+ *                   thread downloading the queued media of that class.
  */
-downloader::downloader(urlsmanager* urlmanager): url_manager(urlmanager) {
+downloader::downloader(urlsmanager* urlmanager, TrafficClass traffic): url_manager(urlmanager), traffic(traffic),
+    revisiting(false), page_status(0) {
     downloading_url = true;
     downloader_thread = thread(&downloader::start, this);
     downloader_thread.detach();
@@ -51,16 +63,395 @@ bool downloader::is_downloading() {
     return downloading_url;
 }
 
-// Callback function to write received data to a string
-size_t text_callback(void* contents, size_t size, size_t nmemb, string* output) {
+// The value of a header line without the name, the spaces and the CRLF
+static string header_value(const string& line, size_t name_size) {
+    size_t start = line.find_first_not_of(" \t", name_size);
+    size_t end = line.find_last_not_of(" \t\r\n");
+    if (start == string::npos || end == string::npos || end < start) {
+        return "";
+    }
+    return line.substr(start, end - start + 1);
+}
+
+/**
+ * @brief Sums up a finished transfer for the concurrency control of its host,
+ *        see hostlimiter.cpp. The latency is the time to the first byte so
+ *        large bodies do not look like a slow server.
+ * 
+ * @param curl The handle after curl_easy_perform.
+ * @param res  What curl_easy_perform returned.
+ * @return host_feedback What the host limiter learns from the transfer.
+ */
+static host_feedback host_feedback_of(CURL* curl, CURLcode res) {
+    host_feedback feedback;
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_off_t retry_after = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK) {
+        feedback.retry_after = retry_after;
+    }
+    feedback.overloaded = status == 429 || status == 503 || res == CURLE_OPERATION_TIMEDOUT;
+
+    // Transfers we stopped ourselves (ranges, size caps) still got their first byte
+    if (res == CURLE_OK || res == CURLE_WRITE_ERROR) {
+        double first_byte = 0;
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &first_byte);
+        feedback.measured = status > 0 && status < 500;
+        feedback.latency = first_byte;
+    }
+    return feedback;
+}
+
+// A weak ETag cannot be used with If-Range, Last-Modified can be instead
+static string range_validator(const string& etag, const string& last_modified) {
+    if (!etag.empty() && etag.compare(0, 2, "W/") != 0) {
+        return etag;
+    }
+    return last_modified;
+}
+
+// Takes bytes from the bandwidth. On the fetch engine a callback cannot wait
+// for the buckets, the transfer is paused instead and gets the same data again
+// when it is resumed
+static bool take_bandwidth(bandwidth_limiter* bandwidth, fetch_engine* engine, CURL* curl,
+                           TrafficClass traffic, const string& host, size_t bytes) {
+    if (!engine) {
+        bandwidth->consume(traffic, host, bytes);
+        return true;
+    }
+    double wait = bandwidth->try_consume(traffic, host, bytes);
+    if (wait > 0) {
+        engine->pause(curl, wait);
+        return false;
+    }
+    return true;
+}
+
+// How long a transfer on the fetch engine is paused when the disk writer
+// pool has no room for its data
+static const double WRITER_PAUSE_SECONDS = 0.05;
+
+// Whether a callback may hand this many bytes to the disk writer pool. On the
+// fetch engine a callback cannot wait for the pool, the transfer is paused
+// instead and gets the same data again when it is resumed
+static bool writer_room(disk_writer* writer, fetch_engine* engine, CURL* curl, size_t bytes) {
+    if (!engine || writer->has_room(bytes)) {
+        return true;
+    }
+    engine->pause(curl, WRITER_PAUSE_SECONDS);
+    return false;
+}
+
+// Counts what a transfer received against the bandwidth. libcurl hands the
+// callbacks the decoded body, the bandwidth is spent on what came over the wire.
+// Returns false if the transfer was paused and the data has to be refused.
+static bool account(transfer_context* transfer, size_t decoded) {
+    if (!transfer->bandwidth) {
+        return true;
+    }
+    size_t wire = decoded;
+    curl_off_t downloaded = 0;
+    bool measured = transfer->curl &&
+        curl_easy_getinfo(transfer->curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded) == CURLE_OK;
+    if (measured) {
+        wire = downloaded > transfer->wire_bytes ? downloaded - transfer->wire_bytes : 0;
+    }
+    if (!take_bandwidth(transfer->bandwidth, transfer->engine, transfer->curl,
+                        transfer->traffic, transfer->host, wire)) {
+        return false;
+    }
+    if (measured) {
+        transfer->wire_bytes = max(transfer->wire_bytes, downloaded);
+    }
+    transfer->bandwidth->add_decoded(transfer->traffic, decoded);
+    return true;
+}
+
+// Marks a transfer whose body went over the cap of its class, the callback
+// that notices aborts the transfer
+static void mark_truncated(transfer_context* transfer) {
+    if (transfer->truncated) {
+        return;
+    }
+    transfer->truncated = true;
+    if (transfer->warc) {
+        transfer->warc->truncated = true;
+    }
+    if (transfer->limits) {
+        transfer->limits->record_truncated(transfer->body);
+    }
+}
+
+// How much of what a callback was handed fits under the cap of the body
+static size_t within_limit(transfer_context* transfer, size_t bytes) {
+    if (!transfer->limits) {
+        return bytes;
+    }
+    size_t allowed = transfer->limits->allowed(transfer->body, transfer->body_bytes, bytes);
+    transfer->body_bytes += allowed;
+    if (allowed < bytes) {
+        mark_truncated(transfer);
+    }
+    return allowed;
+}
+
+// Callback function to write received data to a string or to the media store
+static size_t body_callback(void* contents, size_t size, size_t nmemb, transfer_context* transfer) {
     size_t total_size = size * nmemb;
-    output->append((char*)contents, total_size);
+    // A large media file is downloaded in ranges instead, stop this stream
+    if (transfer->use_ranges) {
+        return 0;
+    }
+    // Nothing is taken before both checks pass, a paused transfer gets the
+    // same data again
+    if ((transfer->media || transfer->warc) &&
+        !writer_room(transfer->writer, transfer->engine, transfer->curl, total_size)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    if (!account(transfer, total_size)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    // Only what fits under the cap is kept, the rest aborts the transfer
+    total_size = within_limit(transfer, total_size);
+    bool wait = !transfer->engine;
+    if (transfer->media) {
+        total_size = transfer->media->store->write(*transfer->media, contents, total_size, wait);
+    } else if (transfer->text) {
+        transfer->text->append((char*)contents, total_size);
+    }
+    if (transfer->warc) {
+        transfer->warc->add_payload(contents, total_size, wait);
+    }
+    return transfer->truncated ? 0 : total_size;
+}
+
+// Callback function that receives the response headers one line at a time
+static size_t header_callback(char* buffer, size_t size, size_t nitems, transfer_context* transfer) {
+    size_t total_size = size * nitems;
+    if (transfer->warc) {
+        transfer->warc->add_response_header(buffer, total_size);
+    }
+    if (transfer->headers) {
+        // Only the headers of the final response are kept
+        if (total_size >= 5 && strncasecmp(buffer, "HTTP/", 5) == 0) {
+            transfer->headers->clear();
+        }
+        transfer->headers->append(buffer, total_size);
+    }
+
+    // The validators of every response are kept for later requests, the
+    // headers of media transfers also tell us how large the body is and
+    // whether the server can send it in ranges
+    static const char length_header[] = "content-length:";
+    static const char ranges_header[] = "accept-ranges:";
+    static const char etag_header[] = "etag:";
+    static const char modified_header[] = "last-modified:";
+    static const char hsts_header[] = "strict-transport-security:";
+    string line(buffer, total_size);
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        size_t space = line.find(' ');
+        transfer->status = space == string::npos ? 0 : strtol(line.c_str() + space + 1, nullptr, 10);
+        if (transfer->status == 302 || transfer->status == 303 || transfer->status == 307) {
+            transfer->temporary_redirect = true;
+        }
+        transfer->content_length = -1;
+        transfer->accept_ranges = false;
+        transfer->etag.clear();
+        transfer->last_modified.clear();
+    } else if (strncasecmp(buffer, etag_header, sizeof(etag_header) - 1) == 0) {
+        transfer->etag = header_value(line, sizeof(etag_header) - 1);
+    } else if (strncasecmp(buffer, modified_header, sizeof(modified_header) - 1) == 0) {
+        transfer->last_modified = header_value(line, sizeof(modified_header) - 1);
+    } else if (strncasecmp(buffer, hsts_header, sizeof(hsts_header) - 1) == 0) {
+        // The url of this hop, only an https response may set it
+        char* hop_url = nullptr;
+        if (transfer->upgrades && transfer->curl &&
+            curl_easy_getinfo(transfer->curl, CURLINFO_EFFECTIVE_URL, &hop_url) == CURLE_OK && hop_url) {
+            transfer->upgrades->observe_hsts(hop_url, header_value(line, sizeof(hsts_header) - 1));
+        }
+    } else if (!transfer->media) {
+        return total_size;
+    } else if (strncasecmp(buffer, length_header, sizeof(length_header) - 1) == 0) {
+        transfer->content_length = strtoll(buffer + sizeof(length_header) - 1, nullptr, 10);
+    } else if (strncasecmp(buffer, ranges_header, sizeof(ranges_header) - 1) == 0) {
+        transfer->accept_ranges = line.find("bytes") != string::npos;
+    } else if ((line == "\r\n" || line == "\n") && transfer->status == 200 && transfer->content_length > 0) {
+        // A file announced larger than the cap is not worth starting on
+        unsigned long long cap = transfer->limits ? transfer->limits->limit(transfer->body) : 0;
+        if (cap > 0 && (unsigned long long)transfer->content_length > cap) {
+            mark_truncated(transfer);
+            return 0;
+        }
+        if (transfer->range_threshold > 0 && transfer->accept_ranges &&
+            (unsigned long long)transfer->content_length >= transfer->range_threshold) {
+            transfer->use_ranges = true;
+        } else {
+            // Media files are preallocated when their size is announced
+            transfer->media->store->expect_size(*transfer->media, transfer->content_length);
+        }
+    }
     return total_size;
 }
 
-// Callback function for libcurl to write downloaded content to a file
-static size_t write_callback(void* contents, size_t size, size_t nmemb, FILE* file) {
-    return fwrite(contents, size, nmemb, file);
+// Callback function libcurl uses to show what it sends, we keep the request headers
+static int debug_callback(CURL* handle, curl_infotype type, char* data, size_t size, transfer_context* transfer) {
+    (void)handle;
+    if (type == CURLINFO_HEADER_OUT && transfer->warc) {
+        transfer->warc->add_request_header(data, size);
+    }
+    return 0;
+}
+
+// Callback function that throws away the body of a content type probe
+static size_t discard_callback(void* contents, size_t size, size_t nmemb, transfer_context* transfer) {
+    (void)contents;
+    if (!account(transfer, size * nmemb)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    // The headers are all a probe needs, a long body is not read to its end
+    size_t kept = within_limit(transfer, size * nmemb);
+    return transfer->truncated ? 0 : kept;
+}
+
+/**
+ * @brief Points a handle at the url and its callbacks at the given transfer.
+ *        What the transfer receives is counted against the bandwidth of its
+ *        class and host. When the crawl is archived the request and the
+ *        response headers are captured as well. Pages are asked for
+ *        compressed (gzip, deflate, brotli or zstd, whatever this libcurl
+ *        was built with) and decoded by libcurl as they stream into the
+ *        callbacks; media are not, they are compressed already and their
+ *        sizes and ranges have to be those of the file. The addresses of the host
+ *        come from the DNS pre-resolution if it looked the host up already.
+ *        The body is cut off at the cap of its class, see bodylimits.cpp.
+ * 
+ * @param curl     The handle of the transfer.
+ * @param url      The url to download.
+ * @param transfer Where the callbacks write what they receive.
+ * @return false if the host is known not to exist, the transfer should
+ *         not be started.
+ */
+bool downloader::setup_transfer(CURL* curl, const string& url, transfer_context& transfer) {
+    transfer.bandwidth = &url_manager->bandwidth;
+    transfer.traffic = traffic;
+    transfer.host = url_host(url);
+    transfer.curl = curl;
+    transfer.upgrades = &url_manager->upgrades;
+    if (url_manager->engine.is_running()) {
+        transfer.engine = &url_manager->engine;
+    }
+    transfer.writer = &url_manager->writer;
+    transfer.limits = &url_manager->limits;
+    transfer.body = transfer.media ? BodyClass::MEDIA : BodyClass::PAGE;
+    url_manager->shared.attach(curl);
+    if (!url_manager->resolver.prepare(curl, url, transfer.resolve)) {
+        return false;
+    }
+    follow_redirects(curl);
+    // An archived response has to be kept as it was sent
+    if (transfer.text && !transfer.warc && url_manager->config.compression) {
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, body_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer);
+    if (transfer.warc) {
+        curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_callback);
+        curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &transfer);
+        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+    }
+    return true;
+}
+
+/**
+ * @brief Lets libcurl follow the redirects of a transfer, at most
+ *        --max-redirects of them.
+ * 
+ * @param curl The handle of the transfer.
+ */
+void downloader::follow_redirects(CURL* curl) {
+    if (url_manager->config.max_redirects > 0) {
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, (long)url_manager->config.max_redirects);
+    }
+}
+
+/**
+ * @brief Records in the redirect map where a finished transfer ended up.
+ * 
+ * @param curl     The handle after curl_easy_perform.
+ * @param url      The url the transfer started from.
+ * @param transfer The transfer, it knows whether a hop was temporary.
+ * @return string The url the response came from.
+ */
+string downloader::record_redirect(CURL* curl, const string& url, const transfer_context& transfer) {
+    long redirects = 0;
+    long status = 0;
+    char* effective = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_REDIRECT_COUNT, &redirects);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    // A chain that ran out of hops did not end anywhere
+    if (redirects == 0 || (status >= 300 && status < 400) ||
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective) != CURLE_OK || !effective) {
+        return url;
+    }
+    url_manager->redirects.record(url, effective, !transfer.temporary_redirect);
+    if (!transfer.temporary_redirect) {
+        url_manager->upgrades.observe_redirect(url, effective);
+    }
+    return effective;
+}
+
+/**
+ * @brief Makes the page this thread works on the target of a redirect,
+ *        unless some other thread has that page already.
+ * 
+ * @param target Where the current page redirects to.
+ * @return true if this thread should go on with the target.
+ */
+bool downloader::move_to(const string& target) {
+    // The https form of the page is the page we claimed already
+    if (url_identity(target) == url_identity(main_url)) {
+        main_url = canonicalize_url(target);
+        base_url = extract_base_url(main_url);
+        return true;
+    }
+    vector<string> claimed = url_manager->claim_unvisited({target});
+    if (claimed.empty()) {
+        url_manager->log(LogType::INFO, "Duplicate URL: " + main_url + " redirects to " + target);
+        return false;
+    }
+    main_url = claimed.front();
+    base_url = extract_base_url(main_url);
+    return true;
+}
+
+/**
+ * @brief Writes a finished transfer to the WARC archive if it was captured.
+ *        The capture holds the last hop of a redirected transfer, so it is
+ *        archived under the url that hop was sent to.
+ * 
+ * @param curl     The handle of the transfer.
+ * @param transfer The transfer that was set up with setup_transfer.
+ */
+void downloader::archive_transfer(CURL* curl, transfer_context& transfer) {
+    if (!transfer.warc) {
+        return;
+    }
+    char* effective_url = nullptr;
+    if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective_url) == CURLE_OK && effective_url) {
+        transfer.warc->url = effective_url;
+    }
+    char* ip = nullptr;
+    if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) == CURLE_OK && ip) {
+        transfer.warc->ip = ip;
+    }
+    if (!transfer.warc->response_headers.empty() && !url_manager->warc.write_transaction(*transfer.warc)) {
+        string message = "Could not archive URL: " + transfer.warc->url;
+        url_manager->log(LogType::ERROR, message);
+    }
 }
 
 
@@ -89,56 +480,192 @@ string downloader::extract_base_url(string& inp_url) {
 
 /**
  * @brief This function is called at the beginning to download the pure html
- *        at the given url and store it inside the given string.
+ *        at the given url and store it inside the given string. Failures
+ *        that may go away (see retry_policy) are retried after a backoff,
+ *        unless the circuit breaker of the host opened in the meantime; then
+ *        the page is parked in the url manager to wait for the host. The
+ *        breaker is asked right before every transfer, so a page answered
+ *        from the HTTP cache never takes its half open transfer.
+ *        A page an earlier crawl stored (see recrawlindex.cpp) is asked for
+ *        with its validators, the server answers 304 if it did not change.
+ *        A page that is fresh in the HTTP cache is not asked for at all.
+ *        A page larger than --max-page-bytes is cut off there and parsed as
+ *        far as it got, it is not stored in the HTTP cache.
  * 
  * @param url Html link that we need to retreive the pure html from.
  * @param downloaded_html String that we save the html in.
+ * @return true if there is a response to parse.
+ * @return false if the page could not be downloaded (yet).
  */
-void downloader::download_html(string& downloaded_html) {
-    
-    lock_guard<mutex> lock(url_manager->curl_mutex);
-    
-    cout << "acquired the lock and will download the html now\n";
+bool downloader::download_html(string& downloaded_html) {
+    string host = url_host(main_url);
 
-    CURL* curl = curl_easy_init();
+    cached_response cached;
+    if (url_manager->cache.lookup(main_url, cached)) {
+        downloaded_html = cached.body;
+        page_status = cached.status;
+        current_page.etag = http_cache::header(cached.headers, "etag");
+        current_page.last_modified = http_cache::header(cached.headers, "last-modified");
+        url_manager->log(LogType::INFO, "Cached URL: " + main_url);
+        return true;
+    }
+    string response_headers;
+    string landed_url;
+    bool truncated = false;
 
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, main_url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, text_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &downloaded_html);
+    for (int attempt = 0; ; attempt++) {
+        downloaded_html.clear();
+        CURLcode res = CURLE_FAILED_INIT;
+        long status = 0;
+        host_feedback feedback;
+        Admission admission = url_manager->breakers.admit(host);
+        if (admission == Admission::WAIT) {
+            url_manager->retry_url(main_url, depth);
+            return false;
+        }
+        if (admission == Admission::DEAD) {
+            url_manager->log(LogType::ERROR, "Host is down, skipping URL: " + main_url);
+            return false;
+        }
+        {
+            host_slot slot(url_manager->hosts, host);
+
+            CURL* curl = curl_easy_init();
+            if (!curl) {
+                url_manager->breakers.release(host);
+                return false;
+            }
+
+            transfer_context transfer;
+            transfer.text = &downloaded_html;
+            if (url_manager->cache.is_open()) {
+                transfer.headers = &response_headers;
+            }
+            unique_ptr<warc_capture> capture;
+            if (url_manager->warc.is_open()) {
+                capture.reset(new warc_capture(main_url, &url_manager->writer, url_manager->warc.spill_path()));
+                transfer.warc = capture.get();
+            }
+
+            if (!setup_transfer(curl, main_url, transfer)) {
+                curl_easy_cleanup(curl);
+                url_manager->breakers.record(host, false);
+                url_manager->log(LogType::ERROR, "URL Not Found: " + main_url + " (host does not resolve)");
+                return false;
+            }
+            struct curl_slist* headers = nullptr;
+            if (revisiting && !known_page.etag.empty()) {
+                headers = curl_slist_append(headers, ("If-None-Match: " + known_page.etag).c_str());
+            }
+            if (revisiting && !known_page.last_modified.empty()) {
+                headers = curl_slist_append(headers, ("If-Modified-Since: " + known_page.last_modified).c_str());
+            }
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+            // Perform the request, a page cut off at its cap is parsed as far
+            // as it got
+            res = url_manager->engine.perform(curl);
+            truncated = transfer.truncated;
+            if (truncated && res == CURLE_WRITE_ERROR) {
+                res = CURLE_OK;
+            }
+            url_manager->shared.record(curl);
+            feedback = host_feedback_of(curl, res);
+            slot.report(feedback);
+            url_manager->breakers.hold(host, feedback.retry_after);
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            archive_transfer(curl, transfer);
+            landed_url = record_redirect(curl, main_url, transfer);
+            page_status = status;
+            current_page.etag = transfer.etag;
+            current_page.last_modified = transfer.last_modified;
+
+            // Clean up
+            curl_easy_cleanup(curl);
+            curl_slist_free_all(headers);
+        }
 
-        // Perform the request
-        CURLcode res = curl_easy_perform(curl);
+        bool retryable = retry_policy::retryable(res, status);
+        url_manager->breakers.record(host, !retryable);
 
         // Check for errors
-        if (res != CURLE_OK) {
-            // cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << " \n";
-            string message = "URL Not Found: " + main_url;
-            url_manager->log(LogType::ERROR, message);
-        } else {
+        if (!retryable) {
+            if (res != CURLE_OK) {
+                // cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << " \n";
+                string message = "URL Not Found: " + main_url;
+                url_manager->log(LogType::ERROR, message);
+                return false;
+            }
+            // Links on the page are relative to where it redirected to
+            if (canonicalize_url(landed_url) != canonicalize_url(main_url) && !move_to(landed_url)) {
+                return false;
+            }
+            if (truncated) {
+                string message = "Truncated URL: " + main_url + " (cut off at " +
+                                 body_limits::option(BodyClass::PAGE) + ")";
+                url_manager->log(LogType::ERROR, message);
+                return true;
+            }
+            url_manager->cache.store(main_url, status, response_headers, downloaded_html);
             string message = "Successful URL: " + string(main_url);
             url_manager->log(LogType::INFO, message);
+            return true;
         }
 
-        // Clean up
-        curl_easy_cleanup(curl);
+        if (url_manager->breakers.check(host) != Admission::ALLOW) {
+            // The host is down or asked us to wait, the page waits for it
+            // with its other urls
+            url_manager->retry_url(main_url, depth);
+            return false;
+        }
+        if (attempt >= url_manager->retries.retries()) {
+            string message = "URL Not Found: " + main_url + " (gave up after " + to_string(attempt + 1) + " attempts)";
+            url_manager->log(LogType::ERROR, message);
+            return false;
+        }
+        this_thread::sleep_for(url_manager->retries.delay(attempt, feedback.retry_after));
     }
 }
 
 /**
  * @brief  Function to parse HTML and extract the text, images, audios
- *         and videos using the gumbo parser
+ *         and videos using the gumbo parser. The text is handed to the
+ *         disk writer pool so this thread does not wait for the disk. With
+ *         --text-output=pack the text is appended to the pack in the text
+ *         directory instead of being written to a file of its own.
  * 
  * @param html_content pure html string
  * @param file_name    the file name that we store the text at.
  */
 void downloader::parse_html(const char* html_content, string& file_name) {
-    ofstream file(file_name);
     GumboOutput* output = gumbo_parse(html_content);
-    extract_text(output->root, file);
+    if (url_manager->config.text_output == "pack") {
+        ostringstream text;
+        extract_text(output->root, text);
+        if (!url_manager->pack.append(main_url, text.str())) {
+            string message = "Could not write the text of URL to the pack: " + main_url;
+            url_manager->log(LogType::ERROR, message);
+        }
+    } else {
+        // The file is written by the disk writer under a temporary name and
+        // renamed once it is complete
+        ostringstream text;
+        extract_text(output->root, text);
+        string content = text.str();
+        disk_file* file = url_manager->writer.open(url_manager->texts.temp_name(main_url));
+        url_manager->writer.write(file, content.data(), content.size());
+        urlsmanager* manager = url_manager;
+        string url = main_url;
+        url_manager->writer.close(file, file_name, [manager, url, file_name](bool ok) {
+            if (ok) {
+                manager->texts.record(url, file_name);
+            } else {
+                manager->log(LogType::ERROR, "Could not write the text of URL: " + url);
+            }
+        });
+    }
     extract_urls(output->root);
     gumbo_destroy_output(&kGumboDefaultOptions, output);
-    file.close();
 }
 
 /**
@@ -147,9 +674,9 @@ void downloader::parse_html(const char* html_content, string& file_name) {
  *        to the file.
  * 
  * @param node The Gumbo node we are currently pointing to.
- * @param file The file that we need to save the text in.
+ * @param file The file (or buffer) that we need to save the text in.
  */
-void downloader::extract_text(GumboNode* node, ofstream& file) {
+void downloader::extract_text(GumboNode* node, ostream& file) {
     if (node->type == GUMBO_NODE_TEXT) {
         // cout << node->v.text.text << " ";
         file << node->v.text.text << " ";
@@ -173,39 +700,186 @@ void downloader::extract_text(GumboNode* node, ofstream& file) {
  *        in determining whether we need to download the content or add the
  *        url to the urls manager thread.
  * 
+ *        Before asking the server we check the probe cache and then let
+ *        the content type predictor guess from the url. Every answer we do
+ *        get from a server is cached and fed back to the predictor so it
+ *        learns the urls of that site.
+ * 
  * @param url Url that we need to get the content of.
  * @return string The content of the url.
  */
 string downloader::get_url_content_type(const char* url) {
+    // Urls linked from every page of a site (or probed in an earlier run)
+    // and urls that failed recently are answered from the probe cache
+    probe_entry cached;
+    if (url_manager->probes.lookup(url, cached)) {
+        return cached.negative ? "" : cached.content_type;
+    }
+
+    // Most urls can be classified from their shape without a request
+    string predicted;
+    if (url_manager->config.predict_types && url_manager->predictor.predict(url, predicted)) {
+        return predicted;
+    }
+
+    return probe_content_type(url, predicted);
+}
+
+/**
+ * @brief Performs the actual probe of get_url_content_type, caching what
+ *        the server answered and feeding it to the predictor.
+ * 
+ * @param url       Url that we need to get the content of.
+ * @param predicted What the predictor would have guessed, if anything, so
+ *                  the guess can be checked against the answer.
+ * @return string The content of the url.
+ */
+string downloader::probe_content_type(const char* url, const string& predicted) {
     CURL* curl;
     CURLcode res;
 
-    lock_guard<mutex> lock(url_manager->curl_mutex);
-    
+    // A page in the HTTP cache has its content type stored with it
+    cached_response cached;
+    if (url_manager->cache.lookup(url, cached, false)) {
+        probe_entry entry;
+        entry.timestamp = time(nullptr);
+        entry.status = cached.status;
+        entry.content_type = http_cache::header(cached.headers, "content-type");
+        url_manager->predictor.observe(url, entry.content_type);
+        if (!predicted.empty()) {
+            url_manager->predictor.record_verification(predicted, entry.content_type);
+        }
+        url_manager->probes.store(url, entry);
+        return entry.content_type;
+    }
+
+    // The link of a host whose breaker is open is parked in the url manager
+    // and probed again once the host is back
+    string host = url_host(url);
+    Admission admission = url_manager->breakers.admit(host);
+    if (admission == Admission::WAIT) {
+        url_manager->park_link(url, depth);
+        return "";
+    }
+    if (admission == Admission::DEAD) {
+        return "";
+    }
+
+    host_slot slot(url_manager->hosts, host);
     curl = curl_easy_init();
 
-    if (curl) {
+    if (!curl) {
+        url_manager->breakers.release(host);
+        url_manager->unclaim(url);
+    } else {
+        url_manager->shared.attach(curl);
         curl_easy_setopt(curl, CURLOPT_URL, url);
 
-        // Set the callback function to handle the response
-        string response;
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, text_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        // We only need the headers of the response so the body is dropped,
+        // it still counts against the bandwidth
+        transfer_context transfer;
+        transfer.bandwidth = &url_manager->bandwidth;
+        transfer.traffic = traffic;
+        transfer.host = url_host(url);
+        transfer.curl = curl;
+        transfer.upgrades = &url_manager->upgrades;
+        if (url_manager->engine.is_running()) {
+            transfer.engine = &url_manager->engine;
+        }
+        transfer.limits = &url_manager->limits;
+        transfer.body = BodyClass::PROBE;
+        follow_redirects(curl);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer);
+        // The body is thrown away, so it is not worth decoding
+        if (url_manager->config.compression) {
+            curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+            curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 0L);
+        }
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+        if (!url_manager->resolver.prepare(curl, url, transfer.resolve)) {
+            url_manager->breakers.record(host, false);
+            curl_easy_cleanup(curl);
+            return "";
+        }
+
+        // Perform the get request, the headers are complete when the body
+        // was cut off at its cap
+        res = url_manager->engine.perform(curl);
+        if (transfer.truncated && res == CURLE_WRITE_ERROR) {
+            res = CURLE_OK;
+        }
+        url_manager->shared.record(curl);
+        host_feedback feedback = host_feedback_of(curl, res);
+        slot.report(feedback);
+        url_manager->breakers.hold(host, feedback.retry_after);
 
-        // Perform the get request
-        res = curl_easy_perform(curl);
+        probe_entry entry;
+        entry.timestamp = time(nullptr);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &entry.status);
+        bool retryable = retry_policy::retryable(res, entry.status);
+        url_manager->breakers.record(host, !retryable);
+        if (res == CURLE_OK) {
+            record_redirect(curl, url, transfer);
+        }
+        // The link is not lost, it waits for its host if the host is down or
+        // asked us to wait and otherwise the next page that links to it
+        // probes it again
+        if (retryable && url_manager->breakers.check(host) != Admission::ALLOW) {
+            url_manager->park_link(url, depth);
+        } else if (retryable) {
+            url_manager->unclaim(url);
+        }
+        // The type of an error page like a 503 is not the type of the link,
+        // the link is handled by whoever probes it again
+        if (retryable && res == CURLE_OK) {
+            curl_easy_cleanup(curl);
+            return "";
+        }
 
         if (res != CURLE_OK) {
             string message = "URL Not Found: " + string(url);
             // url_manager->log(LogType::ERROR, message);
             // Log if needed.
+
+            // None of the urls of a host we cannot reach will work either
+            if (res == CURLE_COULDNT_RESOLVE_HOST || res == CURLE_COULDNT_CONNECT) {
+                entry.negative = true;
+                url_manager->probes.store_host_failure(url_host(url), entry);
+            }
         } else {
             // Check the Content-Type header in the response
-            char* content_type;
+            char* content_type = nullptr;
             res = curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
 
             if (res == CURLE_OK) {
-                string result(content_type);
+                // Some servers do not send a Content-Type at all
+                string result(content_type ? content_type : "");
+                curl_off_t size = -1;
+                curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+                entry.size = size;
+
+                if (entry.status == 404 || entry.status == 410) {
+                    // The error page is not the content of the url
+                    entry.negative = true;
+                    result = "";
+                } else {
+                    entry.content_type = result;
+                    // Only a real answer teaches the predictor, not an error page
+                    if (entry.status < 400) {
+                        url_manager->predictor.observe(url, result);
+                        if (!predicted.empty()) {
+                            url_manager->predictor.record_verification(predicted, result);
+                        }
+                    }
+                }
+
+                // Other errors (like 503) are likely to go away so they are not kept
+                if (entry.negative || entry.status < 400) {
+                    url_manager->probes.store(url, entry);
+                }
+
                 // Clean up
                 curl_easy_cleanup(curl);
                 return result;
@@ -226,108 +900,587 @@ string downloader::get_url_content_type(const char* url) {
 
 }
 
+/**
+ * @brief Finds the content type of all the given urls at the same time.
+ *        Probing the links of a page one after the other costs the sum of
+ *        all their round trips, so instead we start up to max_parallel_probes
+ *        probe threads (the downloader thread itself being one of them) that
+ *        keep taking the next url that has not been probed yet. A page is
+ *        then done in about the time of its slowest link.
+ * 
+ * @param urls The links we need the content type of.
+ * @return vector<string> The content type of each url, in the same order,
+ *                        or an empty string if it could not be found.
+ */
+vector<string> downloader::classify_urls(const vector<string>& urls) {
+    vector<string> content_types(urls.size());
+    atomic<size_t> next_url(0);
+
+    auto probe_urls = [&]() {
+        for (size_t i = next_url++; i < urls.size(); i = next_url++) {
+            try {
+                content_types[i] = get_url_content_type(urls[i].c_str());
+            } catch(const std::exception& e) {
+                // std::cerr << e.what() << '\n';
+                string message = "URL Not Found: " + urls[i];
+                // url_manager->log(LogType::ERROR, message);
+            }
+        }
+    };
+
+    size_t parallel_probes = min(urls.size(), (size_t)max(1, url_manager->config.max_parallel_probes));
+    vector<thread> probe_threads;
+    for (size_t i = 1; i < parallel_probes; i++) {
+        probe_threads.emplace_back(probe_urls);
+    }
+    probe_urls();
+
+    for (thread& probe_thread : probe_threads) {
+        probe_thread.join();
+    }
+
+    return content_types;
+}
+
 /**
  * @brief Function to download the content at the given url and
- *        save it in a file that has the name file_name.
+ *        save it in the media store, which names the file after the
+ *        hash of its content. A url that is already in the store is
+ *        not downloaded again.
  *        The content that this function might store could be 
- *        an image or an audio or a video
+ *        an image or an audio or a video. A download that failed in a
+ *        way that may go away is retried like a page.
  * 
  * @param url  The http url that we need to perform a get request at.
- * @param file_name The name of the file we need to create and save the content in
  */
-void downloader::download_content(const char* url, const char* file_name) {
+void downloader::download_content(const char* url) {
+    for (int attempt = 0; ; attempt++) {
+        bool retryable = false;
+        double retry_after = 0;
+        if (store_content(url, retryable, retry_after)) {
+            return;
+        }
+        // A host with an open breaker or a Retry-After is not retried now,
+        // the url waits in its traffic class until the host may be tried again
+        string host = url_host(url);
+        if (retryable && url_manager->breakers.check(host) != Admission::ALLOW) {
+            url_manager->traffic.defer(traffic, url, url_manager->breakers.next_retry(host));
+            return;
+        }
+        if (!retryable || attempt >= url_manager->retries.retries()) {
+            return;
+        }
+        this_thread::sleep_for(url_manager->retries.delay(attempt, retry_after));
+    }
+}
+
+/**
+ * @brief Performs the download of download_content into the media store.
+ *        An unfinished download left by an earlier attempt is resumed
+ *        first, only the bytes it is missing are requested again. A url
+ *        whose host is not let through by its circuit breaker is put aside
+ *        in its traffic class until the host may be tried again.
+ * 
+ * @param url         The http url that we need to perform a get request at.
+ * @param retryable   Set if the download failed in a way that may go away.
+ * @param retry_after Set to the Retry-After of the response, if any.
+ * @return true if the content is in the media store.
+ * @return false otherwise.
+ */
+bool downloader::store_content(const char* url, bool& retryable, double& retry_after) {
+
+    string digest;
+    if (url_manager->media.lookup(url, digest)) {
+        return true;
+    }
+
+    // A host whose breaker is open is waited for, a dead one is given up on
+    string host = url_host(url);
+    Admission admission = url_manager->breakers.admit(host);
+    if (admission == Admission::WAIT) {
+        url_manager->traffic.defer(traffic, url, url_manager->breakers.next_retry(host));
+        return false;
+    }
+    if (admission == Admission::DEAD) {
+        url_manager->log(LogType::ERROR, "Host is down, skipping URL: " + string(url));
+        return false;
+    }
 
-    lock_guard<mutex> lock(url_manager->curl_mutex);
+    host_slot slot(url_manager->hosts, host);
+    bool stored = false;
+    bool archived = url_manager->warc.is_open();
+
+    // The archive needs whole responses so archived media are never resumed
+    // or split in ranges
+    media_partial partial;
+    if (!archived && url_manager->media.load_partial(url, partial)) {
+        url_manager->log(LogType::INFO, "Resuming URL: " + string(url));
+        bool changed = false;
+        if (fetch_ranges(partial, digest, changed)) {
+            url_manager->breakers.record(host, true);
+            url_manager->log(LogType::INFO, "Successful URL: " + string(url));
+            return true;
+        }
+        if (!changed) {
+            // The partial file is kept, the next attempt resumes it again
+            url_manager->breakers.record(host, false);
+            retryable = true;
+            url_manager->log(LogType::ERROR, "Could not resume URL: " + string(url));
+            return false;
+        }
+        // The content changed since the partial file was written, start over
+    }
 
     CURL* curl = curl_easy_init();
     
-    if (curl) {
-        FILE* file = fopen(file_name, "wb");
+    if (!curl) {
+        url_manager->breakers.release(host);
+    } else {
+        media_transfer media;
+
+        if (url_manager->media.begin(url, media)) {
+            transfer_context transfer;
+            transfer.media = &media;
+            unique_ptr<warc_capture> capture;
+            if (archived) {
+                capture.reset(new warc_capture(url, &url_manager->writer, url_manager->warc.spill_path()));
+                transfer.warc = capture.get();
+            } else if (url_manager->config.range_parts > 1) {
+                transfer.range_threshold = url_manager->config.range_threshold;
+            }
 
-        if (file) {
-            curl_easy_setopt(curl, CURLOPT_URL, url);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
+            if (!setup_transfer(curl, url, transfer)) {
+                url_manager->media.abort(media);
+                curl_easy_cleanup(curl);
+                url_manager->breakers.record(host, false);
+                url_manager->log(LogType::ERROR, "URL Not Found: " + string(url) + " (host does not resolve)");
+                return false;
+            }
 
             // Perform the request
-            CURLcode res = curl_easy_perform(curl);
+            CURLcode res = url_manager->engine.perform(curl);
+            url_manager->shared.record(curl);
+            host_feedback feedback = host_feedback_of(curl, res);
+            slot.report(feedback);
+            url_manager->breakers.hold(host, feedback.retry_after);
+            archive_transfer(curl, transfer);
+            long status = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            retryable = retry_policy::retryable(res, status);
+            retry_after = feedback.retry_after;
+            if (res == CURLE_OK) {
+                record_redirect(curl, url, transfer);
+            }
+            // A transfer handed over to the ranges was aborted on purpose,
+            // the ranges decide how it went
+            if (!transfer.use_ranges) {
+                url_manager->breakers.record(host, !retryable);
+            }
 
-            // Check for errors
-            if (res != CURLE_OK) {
+            // What a large download needs to be resumed later
+            partial.url = url;
+            partial.path = url_manager->media.partial_path(url);
+            partial.etag = transfer.etag;
+            partial.last_modified = transfer.last_modified;
+            partial.length = transfer.content_length;
+            bool resumable = !archived && transfer.accept_ranges && transfer.content_length > 0 &&
+                             !range_validator(transfer.etag, transfer.last_modified).empty();
+
+            // Check for errors, an error page is not the content we wanted either
+            if (transfer.truncated) {
+                url_manager->media.abort(media);
+                string message = "Truncated URL: " + string(url) + " (larger than " +
+                                 body_limits::option(BodyClass::MEDIA) + ")";
+                url_manager->log(LogType::ERROR, message);
+            } else if (transfer.use_ranges) {
+                url_manager->media.abort(media);
+                partial.missing = {{0, transfer.content_length - 1}};
+                bool changed = false;
+                if (fetch_ranges(partial, digest, changed)) {
+                    url_manager->breakers.record(host, true);
+                    string message = "Successful URL: " + string(url);
+                    url_manager->log(LogType::INFO, message);
+                    stored = true;
+                } else {
+                    // The next attempt resumes the pieces that are done, or
+                    // starts over when the file changed on the server
+                    url_manager->breakers.record(host, changed);
+                    retryable = true;
+                    string message = "Could not download the ranges of URL: " + string(url);
+                    url_manager->log(LogType::ERROR, message);
+                }
+            } else if (res != CURLE_OK && status == 200 && resumable && media.bytes > 0 &&
+                       media.bytes < transfer.content_length) {
+                // The connection broke in the middle of the body, keep what we have
+                partial.missing = {{media.bytes, transfer.content_length - 1}};
+                url_manager->media.suspend(media, partial);
+                string message = "URL Not Found: " + string(url) + " (kept " +
+                                 to_string(media.bytes) + " bytes to resume)";
+                url_manager->log(LogType::ERROR, message);
+            } else if (res != CURLE_OK || status >= 400) {
                 // fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+                url_manager->media.abort(media);
                 string message = "URL Not Found: " + string(url);
                 url_manager->log(LogType::ERROR, message);
-            } else {
+            } else if (url_manager->media.commit(media, digest)) {
                 string message = "Successful URL: " + string(url);
                 url_manager->log(LogType::INFO, message);
+                stored = true;
+            } else {
+                string message = "Could not store the content of URL: " + string(url);
+                url_manager->log(LogType::ERROR, message);
             }
-
-            // Clean up
-            fclose(file);
         } else {
+            url_manager->breakers.release(host);
             fprintf(stderr, "Failed to open file for writing\n");
         }
 
         // Clean up
         curl_easy_cleanup(curl);
     }
+    return stored;
+}
+
+// Callback function that writes one range of a media file at its offset
+static size_t range_callback(void* contents, size_t size, size_t nmemb, range_part* part) {
+    size_t total_size = size * nmemb;
+    // A 200 instead of a 206 is the whole file, because If-Range did not
+    // match (the file changed) or because the server ignored the range
+    long status = 0;
+    curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status != 206) {
+        part->changed = status == 200;
+        return 0;
+    }
+    // More than we asked for means the server ignored the range
+    if ((long long)total_size > part->remaining) {
+        return 0;
+    }
+    if (!writer_room(part->writer, part->engine, part->curl, total_size)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    if (part->bandwidth && !take_bandwidth(part->bandwidth, part->engine, part->curl,
+                                           part->traffic, part->host, total_size)) {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+    // The disk writer pool writes it at the offset of the piece
+    part->writer->write(part->file, contents, total_size, !part->engine);
+    part->offset += total_size;
+    part->remaining -= total_size;
+    return total_size;
 }
 
 /**
- * @brief Recursively visits the Gumbo nodes and gets the content type of the
- *        current node. If it finds content that should be downloaded it will
- *        setup the filename and call the download_content function to download
- *        that content. If it finds a url that we can visit it should add it 
- *        to the list of new urls we should visit.
+ * @brief Downloads the missing ranges of a media file, --range-parts of them
+ *        at the same time. store_content calls this for a large file whose
+ *        server accepts ranges and for a file an earlier attempt did not
+ *        finish. The missing bytes are split in pieces of at most
+ *        RANGE_PIECE_SIZE and every piece is handed to the disk writer pool as
+ *        it arrives, which writes it at its offset. Each finished piece is recorded in the sidecar of
+ *        the partial file so a failure or a restart loses at most the pieces
+ *        that were in flight. The requests carry If-Range with the ETag (or
+ *        Last-Modified) of the first response so a file that changed on the
+ *        server is never stitched together from two versions. The caller
+ *        holds one connection of the host already, the other pieces only
+ *        get a thread when the host has a free connection right now.
  * 
- * @param node     The current GumboNode we are pointing at.
- * @param base_url The base url in case we find a relative url.
+ * @param partial The file, its validators and the ranges it is missing.
+ * @param digest  Set to the digest the file is stored under.
+ * @param changed Set when the file changed on the server and the partial
+ *                file was dropped.
+ * @return true if the file is in the media store.
+ * @return false otherwise.
+ */
+bool downloader::fetch_ranges(media_partial& partial, string& digest, bool& changed) {
+    static const long long RANGE_PIECE_SIZE = 16LL << 20;
+
+    int fd = ::open(partial.path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // Without preallocation the file is only fragmented, the ranges still work
+    fallocate(fd, 0, 0, partial.length);
+
+    string validator = range_validator(partial.etag, partial.last_modified);
+    int parallel = max(1, url_manager->config.range_parts);
+    long long missing_bytes = 0;
+    for (const auto& range : partial.missing) {
+        missing_bytes += range.second - range.first + 1;
+    }
+    long long piece_size = min(RANGE_PIECE_SIZE, max(1LL, (missing_bytes + parallel - 1) / parallel));
+
+    vector<range_part> pieces;
+    for (const auto& range : partial.missing) {
+        for (long long start = range.first; start <= range.second; start += piece_size) {
+            range_part piece;
+            piece.path = partial.path;
+            piece.writer = &url_manager->writer;
+            piece.start = piece.offset = start;
+            piece.remaining = min(piece_size, range.second - start + 1);
+            piece.bandwidth = &url_manager->bandwidth;
+            piece.traffic = traffic;
+            piece.host = url_host(partial.url);
+            pieces.push_back(piece);
+        }
+    }
+
+    // The sidecar lists the pieces that are not done. The workers only copy
+    // a piece back when it is finished, so the pieces in flight are listed
+    // from where they started and their bytes are fetched again after a crash
+    mutex checkpoint_mutex;
+    auto checkpoint = [&]() {
+        if (url_manager->config.durable_writes) {
+            fdatasync(fd);
+        }
+        partial.missing.clear();
+        for (const range_part& piece : pieces) {
+            if (piece.remaining > 0) {
+                partial.missing.emplace_back(piece.offset, piece.offset + piece.remaining - 1);
+            }
+        }
+        url_manager->media.save_partial(partial);
+    };
+
+    atomic<size_t> next_piece(0);
+    atomic<bool> failed(false);
+    auto work = [&]() {
+        size_t i;
+        while (!failed && (i = next_piece++) < pieces.size()) {
+            range_part piece = pieces[i];
+            bool ok = fetch_range(partial.url.c_str(), piece, validator);
+
+            lock_guard<mutex> lock(checkpoint_mutex);
+            pieces[i].offset = piece.offset;
+            pieces[i].remaining = piece.remaining;
+            pieces[i].changed = piece.changed;
+            if (!ok) {
+                failed = true;
+            } else {
+                checkpoint();
+            }
+        }
+    };
+
+    checkpoint();
+
+    string host = url_host(partial.url);
+    vector<thread> helpers;
+    for (int i = 1; i < parallel && i < (int)pieces.size() && url_manager->hosts.try_acquire(host); i++) {
+        helpers.emplace_back([&, host]() {
+            work();
+            url_manager->hosts.release(host);
+        });
+    }
+    work();
+    for (thread& helper : helpers) {
+        helper.join();
+    }
+
+    changed = any_of(pieces.begin(), pieces.end(), [](const range_part& piece) { return piece.changed; });
+    // Every piece that did not fail got exactly the bytes it asked for
+    bool ok = !failed;
+    if (ok && url_manager->config.durable_writes) {
+        ok = fdatasync(fd) == 0;
+    }
+    if (!ok && !changed && validator.empty()) {
+        // Nothing tells us the next attempt gets the same file
+        changed = true;
+    }
+    if (!ok && !changed) {
+        checkpoint();
+    }
+    ::close(fd);
+
+    if (changed) {
+        url_manager->media.drop_partial(partial);
+        return false;
+    }
+    if (!ok) {
+        return false;
+    }
+    // adopt moves the file away, only the sidecar is left to remove
+    bool stored = url_manager->media.adopt(partial.url, partial.path, digest);
+    url_manager->media.drop_partial(partial);
+    return stored;
+}
+
+/**
+ * @brief Downloads one piece of fetch_ranges.
+ * 
+ * @param url       The url of the media file.
+ * @param part      The piece, its offset and remaining bytes are updated.
+ * @param validator The ETag or Last-Modified sent as If-Range, may be empty.
+ * @return true if the server sent exactly the piece.
+ */
+bool downloader::fetch_range(const char* url, range_part& part, const string& validator) {
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+        return false;
+    }
+    string range = to_string(part.offset) + "-" + to_string(part.offset + part.remaining - 1);
+    struct curl_slist* headers = nullptr;
+    if (!validator.empty()) {
+        headers = curl_slist_append(headers, ("If-Range: " + validator).c_str());
+    }
+    part.curl = curl;
+    if (url_manager->engine.is_running()) {
+        part.engine = &url_manager->engine;
+    }
+    // The piece only counts as done once its bytes are on disk
+    long long offset = part.offset;
+    long long remaining = part.remaining;
+    part.file = part.writer->open_at(part.path, part.offset);
+    url_manager->shared.attach(curl);
+    follow_redirects(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, range_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &part);
+
+    CURLcode res = url_manager->engine.perform(curl);
+    url_manager->shared.record(curl);
+    host_feedback feedback = host_feedback_of(curl, res);
+    url_manager->hosts.report(url_host(url), feedback);
+    url_manager->breakers.hold(url_host(url), feedback.retry_after);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_cleanup(curl);
+    curl_slist_free_all(headers);
+    part.curl = nullptr;
+
+    promise<bool> written;
+    future<bool> result = written.get_future();
+    part.writer->close(part.file, "", [&written](bool ok) { written.set_value(ok); });
+    part.file = nullptr;
+    if (!result.get()) {
+        part.offset = offset;
+        part.remaining = remaining;
+        return false;
+    }
+    // 416 means the file is shorter than it was
+    if (status == 200 || status == 416) {
+        part.changed = true;
+    }
+    return res == CURLE_OK && status == 206 && part.remaining == 0;
+}
+
+/**
+ * @brief Gets the content type of every link on the page and acts on it.
+ *        If it finds content that should be downloaded it will call the
+ *        download_content function to download that content. If it finds a url that we can visit it should add it to
+ *        the list of new urls we should visit. The links are collected from
+ *        the whole tree first so that the ones another thread already took
+ *        care of can be dropped and the rest classified all at once.
+ * 
+ * @param node     The root GumboNode of the page.
  */
 void downloader::extract_urls(GumboNode* node) {
+    vector<string> urls;
+    collect_urls(node, urls);
+
+    // Kept for the next crawl, which follows them without parsing the page
+    // again if it did not change
+    if (!url_manager->config.recrawl_file.empty() && page_status == 200) {
+        current_page.outlinks = urls;
+        url_manager->recrawl.store(main_url, current_page);
+    }
+    expand_urls(urls);
+}
+
+/**
+ * @brief Claims the links of a page that are not visited yet and follows
+ *        them with follow_urls.
+ * 
+ * @param urls The absolute urls the page links to.
+ */
+void downloader::expand_urls(vector<string> urls) {
+    // Links to https only hosts and links known to redirect are claimed
+    // under the url they end up at
+    for (string& url : urls) {
+        url = url_manager->redirects.resolve(url_manager->upgrades.upgrade(url));
+    }
+    follow_urls(url_manager->claim_unvisited(urls));
+}
+
+/**
+ * @brief Probes links this thread claimed and hands each to the url manager
+ *        or the media threads, depending on what it is. A link parked while
+ *        its host was down comes back here without being claimed again.
+ * 
+ * @param urls The canonical urls of the claimed links.
+ */
+void downloader::follow_urls(vector<string> urls) {
+    // The new hosts are looked up while the first probes are on their way
+    for (const string& url : urls) {
+        url_manager->resolver.prefetch(url);
+    }
+    vector<string> content_types = classify_urls(urls);
+
+    for (size_t i = 0; i < urls.size(); i++) {
+        string& url = urls[i];
+        string& content_type = content_types[i];
+
+        // The probe may have found out that the link redirects, another page
+        // may link to the target already
+        string target = url_manager->redirects.resolve(url_manager->upgrades.upgrade(url));
+        if (url_identity(target) == url_identity(url)) {
+            url = canonicalize_url(target);
+        } else {
+            vector<string> claimed = url_manager->claim_unvisited({target});
+            if (claimed.empty()) {
+                continue;
+            }
+            url = claimed.front();
+        }
+
+        // If the content is an image or a video or an audio download it.
+        // Note: if the content is base64 encoded it will not recognize it
+        // TODO: take care of this later (maybe?)
+        if (content_type.find("image") != string::npos ||
+            content_type.find("video") != string::npos ||
+            content_type.find("audio") != string::npos) {
+            
+            // The media threads of its class download it in the background
+            probe_entry probed;
+            long long size = url_manager->probes.lookup(url, probed) ? probed.size : -1;
+            TrafficClass media_class = url_manager->traffic.classify(content_type, size);
+            url_manager->traffic.push(media_class, url);
+        } else if (content_type.find("html") != string::npos) {
+            // Add this to the list of urls we extracted
+            url_manager->add_url(url, depth - 1);
+        }
+    }
+}
+
+/**
+ * @brief Recursively visits the Gumbo nodes and collects the absolute url of
+ *        every href or src attribute it finds.
+ * 
+ * @param node The current GumboNode we are pointing at.
+ * @param urls The list we add the urls we find to.
+ */
+void downloader::collect_urls(GumboNode* node, vector<string>& urls) {
     if (node->type == GUMBO_NODE_ELEMENT) {
         GumboAttribute *attr = nullptr;
         attr = gumbo_get_attribute(&node->v.element.attributes, "href");
         if (!attr) 
             attr = gumbo_get_attribute(&node->v.element.attributes, "src");
 
-        if (attr) {
+        // Links to a fragment of the same page do not point to anything new
+        if (attr && attr->value[0] != '\0' && attr->value[0] != '#') {
             string url(attr->value);
             // Check if the url is already an absolute one
             if (url.find("://") == string::npos) {
                 // cout << "found a relative url" << endl;
                 url = base_url + url; // a relative url is found
             }
-
-            string content_type;
-            try {
-                content_type = get_url_content_type(url.c_str());
-            } catch(const std::exception& e) {
-                // std::cerr << e.what() << '\n';
-                string message = "URL Not Found: " + url;
-                // url_manager->log(LogType::ERROR, message);
-            }
-            
-
-            // If the content is an image or a video or an audio download it.
-            // Note: if the content is base64 encoded it will not recognize it
-            // TODO: take care of this later (maybe?)
-            if (content_type.find("image") != string::npos ||
-                content_type.find("video") != string::npos ||
-                content_type.find("audio") != string::npos) {
-                
-                string filename = url.substr(url.find_last_of('/') + 1);
-                string path = "contents/" + filename;
-                download_content(url.c_str(), path.c_str()); 
-            } else if (content_type.find("html") != string::npos) {
-                // Add this to the list of urls we extracted
-                url_manager->add_url(url, depth - 1);
-            }
-            
+            urls.emplace_back(url);
         }
 
         GumboVector* children = &node->v.element.children;
         for (unsigned int i = 0; i < children->length; ++i) {
-            extract_urls(static_cast<GumboNode*>(children->data[i]));
+            collect_urls(static_cast<GumboNode*>(children->data[i]), urls);
         }
     }
 }
@@ -337,33 +1490,90 @@ void downloader::extract_urls(GumboNode* node) {
  *        Here we get the url we need to download and save its html in a string
  *        and then parse that html and store the necessary content. This function
  *        needs to continue running because when it exits the respective
- *        downloader thread will terminate.
+ *        downloader thread will terminate. The threads of the asset and
+ *        media classes only download the media queued for their class.
  * 
  */
 void downloader::start() {
-    auto pair = url_manager->get_url();
+    if (traffic != TrafficClass::HTML) {
+        string url;
+        while (url_manager->traffic.pop(traffic, url)) {
+            download_content(url.c_str());
+        }
+        downloading_url = false;
+        return;
+    }
+
+    bool link = false;
+    auto pair = url_manager->get_url(link);
     main_url = string(pair.first);
     depth = pair.second;
 
     while (depth != -1) {
+        if (link) {
+            // A link that waited for its host, depth is the one of its page
+            follow_urls({main_url});
+            url_manager->finish_url();
+            auto pair = url_manager->get_url(link);
+            main_url = string(pair.first);
+            depth = pair.second;
+            continue;
+        }
         base_url = extract_base_url(main_url);
         string html;
 
+        // A url known to redirect is fetched at its target right away
+        string target = url_manager->redirects.resolve(url_manager->upgrades.upgrade(main_url));
+        if (target != main_url && !move_to(target)) {
+            url_manager->finish_url();
+            auto pair = url_manager->get_url(link);
+            main_url = string(pair.first);
+            depth = pair.second;
+            continue;
+        }
+
         // cout << "Main url is: " << main_url << endl;
-        string fname = main_url.substr(6); //remove https:
-        fname.erase(remove(fname.begin(), fname.end(), '.'), fname.end());
-        fname.erase(remove(fname.begin(), fname.end(), '/'), fname.end());
-        string file_name = "text/" + fname + ".txt";
+        string file_name = url_manager->texts.file_name(main_url);
 
 
+        // A page an earlier crawl stored is only asked for again if it changed,
+        // unless its text is gone
+        revisiting = !url_manager->config.recrawl_file.empty() &&
+                     url_manager->recrawl.lookup(main_url, known_page) &&
+                     (url_manager->config.text_output == "pack" || filesystem::exists(file_name));
+        current_page = page_record();
+        page_status = 0;
+
         // cout << "going to download the html\n";
-        download_html(html);
-        // cout << html << endl;
-        // cout << "going to parse the html\n";
-        parse_html(html.c_str(), file_name);
+        // A page that could not be downloaded has nothing to parse
+        string requested_url = main_url;
+        if (download_html(html)) {
+            // The text of a redirected page is kept under the url it redirected to
+            if (main_url != requested_url) {
+                file_name = url_manager->texts.file_name(main_url);
+            }
+            current_page.content_hash = recrawl_index::hash_of(html);
+            if (revisiting && (page_status == 304 ||
+                               (page_status == 200 && current_page.content_hash == known_page.content_hash))) {
+                // Unchanged, its links are the ones we stored
+                url_manager->log(LogType::INFO, "Not modified URL: " + main_url);
+                url_manager->recrawl.count_unchanged();
+                if (page_status == 200) {
+                    known_page.etag = current_page.etag;
+                    known_page.last_modified = current_page.last_modified;
+                    url_manager->recrawl.store(main_url, known_page);
+                }
+                expand_urls(known_page.outlinks);
+            } else {
+                // cout << html << endl;
+                // cout << "going to parse the html\n";
+                parse_html(html.c_str(), file_name);
+            }
+        }
+        url_manager->finish_url();
         // cout << "done with the url\n";
 
-        auto pair = url_manager->get_url();
+        auto pair = url_manager->get_url(link);
         main_url = string(pair.first);
         depth = pair.second;
     }
@@ -6,6 +6,8 @@
 #include <gumbo.h>
 #include <curl/curl.h>
 #include <mutex>
+#include <vector>
+#include <atomic>
 #include "urlsmanager.h"
 #include "logger.h"
 
@@ -14,6 +16,54 @@
 
 using namespace std;
 
+// Everything the libcurl callbacks of one transfer write to
+struct transfer_context {
+    string* text = nullptr;
+    media_transfer* media = nullptr;
+    warc_capture* warc = nullptr;
+    long status = 0;
+    long long content_length = -1;
+    bool accept_ranges = false;
+    string etag;
+    string last_modified;
+    unsigned long long range_threshold = 0;
+    bool use_ranges = false;
+    bandwidth_limiter* bandwidth = nullptr;
+    TrafficClass traffic = TrafficClass::HTML;
+    string host;
+    curl_slist* resolve = nullptr;
+    CURL* curl = nullptr;
+    curl_off_t wire_bytes = 0;
+    string* headers = nullptr;
+    bool temporary_redirect = false;
+    scheme_upgrades* upgrades = nullptr;
+    fetch_engine* engine = nullptr;
+    disk_writer* writer = nullptr;
+    body_limits* limits = nullptr;
+    BodyClass body = BodyClass::PAGE;
+    unsigned long long body_bytes = 0;
+    bool truncated = false;
+    ~transfer_context() {
+        curl_slist_free_all(resolve);
+    }
+};
+
+// One range of a media file that is downloaded in parts
+struct range_part {
+    string path;
+    disk_file* file = nullptr;
+    disk_writer* writer = nullptr;
+    long long start = 0;
+    long long offset = 0;
+    long long remaining = 0;
+    CURL* curl = nullptr;
+    bool changed = false;
+    bandwidth_limiter* bandwidth = nullptr;
+    TrafficClass traffic = TrafficClass::HTML;
+    string host;
+    fetch_engine* engine = nullptr;
+};
+
 class downloader {
 private:
     urlsmanager* url_manager;
@@ -21,20 +71,38 @@ private:
     string main_url;
     string base_url;
     int depth;
+    TrafficClass traffic;
+    bool revisiting;
+    page_record known_page;
+    page_record current_page;
+    long page_status;
     downloader(const downloader&);
-    bool downloading_url;
+    atomic<bool> downloading_url;
 public:
     bool is_downloading();
-    downloader(urlsmanager* urlmanger);
+    downloader(urlsmanager* urlmanger, TrafficClass traffic = TrafficClass::HTML);
     ~downloader() {}
     void start();
     string extract_base_url(string& inp_url);
-    void download_html(string& downloaded_html);
+    bool setup_transfer(CURL* curl, const string& url, transfer_context& transfer);
+    void archive_transfer(CURL* curl, transfer_context& transfer);
+    void follow_redirects(CURL* curl);
+    string record_redirect(CURL* curl, const string& url, const transfer_context& transfer);
+    bool move_to(const string& target);
+    bool download_html(string& downloaded_html);
     void parse_html(const char* html_content, string& file_name);
-    void extract_text(GumboNode* node, ofstream& file);
+    void extract_text(GumboNode* node, ostream& file);
     void extract_urls(GumboNode* node);
+    void expand_urls(vector<string> urls);
+    void follow_urls(vector<string> urls);
+    void collect_urls(GumboNode* node, vector<string>& urls);
+    vector<string> classify_urls(const vector<string>& urls);
     string get_url_content_type(const char* url);
-    void download_content(const char* url, const char* file_name);
+    string probe_content_type(const char* url, const string& predicted);
+    void download_content(const char* url);
+    bool store_content(const char* url, bool& retryable, double& retry_after);
+    bool fetch_ranges(media_partial& partial, string& digest, bool& changed);
+    bool fetch_range(const char* url, range_part& part, const string& validator);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,191 @@
+/**
+ * @file fetchengine.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Runs the transfers of all the threads on one libcurl multi handle
+ *         so they can share HTTP/2 connections. Crawling one big site with a
+ *         handle per transfer either opens a connection for every transfer
+ *         or makes them wait for each other; on the multi handle the
+ *         transfers to a host that speaks HTTP/2 become streams of the same
+ *         connection (CURLPIPE_MULTIPLEX), up to --streams-per-connection of
+ *         them, and a new transfer waits for the connection being set up to
+ *         the host instead of opening one of its own (CURLOPT_PIPEWAIT).
+ *         --connections-per-host caps the connections to one host as well.
+ * 
+ *         The threads still work one transfer at a time: perform hands the
+ *         handle to the engine thread and blocks until it is done, so the
+ *         callbacks run on the engine thread. A callback must not sleep or
+ *         touch the disk there: a transfer that is over its bandwidth, or
+ *         whose data the disk writer pool has no room for, pauses itself
+ *         and the engine resumes it later, and what it receives is handed
+ *         to the pool without waiting.
+ *         With --multiplex=0 perform is curl_easy_perform on the calling
+ *         thread, as before.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "fetchengine.h"
+#include <algorithm>
+
+using clock_type = chrono::steady_clock;
+
+// Longest time the engine sleeps when nothing happens, new transfers and
+// the end of a pause wake it up sooner
+static const int POLL_MS = 1000;
+
+fetch_engine::fetch_engine(): multi(nullptr), stopping(false), transfers(0), http2_transfers(0), most_running(0) {}
+
+fetch_engine::~fetch_engine() {
+    stop();
+}
+
+/**
+ * @brief Creates the multi handle and starts the engine thread.
+ *        curl_global_init must have been called.
+ * 
+ * @param streams_per_connection Transfers one HTTP/2 connection carries at once.
+ * @param connections_per_host   Connections to one host, 0 for no limit.
+ * @return true if the engine runs.
+ */
+bool fetch_engine::start(long streams_per_connection, long connections_per_host) {
+    multi = curl_multi_init();
+    if (!multi) {
+        return false;
+    }
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, max(1L, streams_per_connection));
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max(0L, connections_per_host));
+    stopping = false;
+    engine_thread = thread(&fetch_engine::run, this);
+    return true;
+}
+
+/**
+ * @brief Runs a transfer and waits for it, like curl_easy_perform.
+ * 
+ * @param curl The handle of the transfer, set up and not in use.
+ * @return CURLcode The result of the transfer.
+ */
+CURLcode fetch_engine::perform(CURL* curl) {
+    if (!multi) {
+        return curl_easy_perform(curl);
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+    promise<CURLcode> done;
+    future<CURLcode> result = done.get_future();
+    {
+        lock_guard<mutex> lock(engine_mutex);
+        incoming.emplace_back(curl, &done);
+    }
+    curl_multi_wakeup(multi);
+    return result.get();
+}
+
+/**
+ * @brief Resumes a transfer after the given time. Called on the engine thread
+ *        by a callback that returned CURL_WRITEFUNC_PAUSE.
+ */
+void fetch_engine::pause(CURL* curl, double seconds) {
+    auto until = clock_type::now() + chrono::duration_cast<clock_type::duration>(chrono::duration<double>(seconds));
+    paused.emplace_back(curl, until);
+}
+
+// Resumes the paused transfers whose time has come
+void fetch_engine::resume_paused(clock_type::time_point now) {
+    vector<CURL*> due;
+    for (auto it = paused.begin(); it != paused.end(); ) {
+        if (it->second <= now) {
+            due.push_back(it->first);
+            it = paused.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Resuming delivers the held data right away, the callback may pause again
+    for (CURL* curl : due) {
+        curl_easy_pause(curl, CURLPAUSE_CONT);
+    }
+}
+
+/**
+ * @brief Body of the engine thread.
+ */
+void fetch_engine::run() {
+    while (true) {
+        {
+            lock_guard<mutex> lock(engine_mutex);
+            for (auto& item : incoming) {
+                CURLMcode added = curl_multi_add_handle(multi, item.first);
+                if (added != CURLM_OK) {
+                    item.second->set_value(CURLE_FAILED_INIT);
+                    continue;
+                }
+                running[item.first] = item.second;
+            }
+            incoming.clear();
+            most_running = max(most_running.load(), (long)running.size());
+            if (stopping && running.empty()) {
+                return;
+            }
+        }
+
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+
+        CURLMsg* message;
+        int left = 0;
+        while ((message = curl_multi_info_read(multi, &left))) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL* curl = message->easy_handle;
+            CURLcode result = message->data.result;
+            long version = 0;
+            curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version);
+            transfers++;
+            if (version == CURL_HTTP_VERSION_2_0) {
+                http2_transfers++;
+            }
+            curl_multi_remove_handle(multi, curl);
+            paused.erase(remove_if(paused.begin(), paused.end(),
+                                   [curl](const auto& item) { return item.first == curl; }), paused.end());
+
+            lock_guard<mutex> lock(engine_mutex);
+            auto it = running.find(curl);
+            if (it != running.end()) {
+                it->second->set_value(result);
+                running.erase(it);
+            }
+        }
+
+        clock_type::time_point now = clock_type::now();
+        resume_paused(now);
+        int timeout = POLL_MS;
+        for (const auto& item : paused) {
+            auto wait = chrono::duration_cast<chrono::milliseconds>(item.second - now).count();
+            timeout = min(timeout, (int)max(1L, (long)wait));
+        }
+        curl_multi_poll(multi, nullptr, 0, timeout, nullptr);
+    }
+}
+
+/**
+ * @brief Stops the engine thread once its transfers are done.
+ */
+void fetch_engine::stop() {
+    if (!multi) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(engine_mutex);
+        stopping = true;
+    }
+    curl_multi_wakeup(multi);
+    engine_thread.join();
+    curl_multi_cleanup(multi);
+    multi = nullptr;
+}
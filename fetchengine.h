@@ -0,0 +1,44 @@
+// fetchengine.h
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <curl/curl.h>
+
+#ifndef _FETCHENGINE_H_
+#define _FETCHENGINE_H_
+
+using namespace std;
+
+class fetch_engine {
+private:
+    CURLM* multi;
+    thread engine_thread;
+    mutex engine_mutex;
+    deque<pair<CURL*, promise<CURLcode>*>> incoming;
+    unordered_map<CURL*, promise<CURLcode>*> running;
+    vector<pair<CURL*, chrono::steady_clock::time_point>> paused;
+    bool stopping;
+    atomic<long> transfers;
+    atomic<long> http2_transfers;
+    atomic<long> most_running;
+    void run();
+    void resume_paused(chrono::steady_clock::time_point now);
+public:
+    fetch_engine();
+    ~fetch_engine();
+    bool start(long streams_per_connection, long connections_per_host);
+    bool is_running() { return multi != nullptr; }
+    CURLcode perform(CURL* curl);
+    void pause(CURL* curl, double seconds);
+    void stop();
+    long transfer_count() { return transfers; }
+    long http2_count() { return http2_transfers; }
+    long most_running_count() { return most_running; }
+};
+
+#endif
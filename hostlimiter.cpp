@@ -0,0 +1,142 @@
+/**
+ * @file hostlimiter.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Limits how many transfers run against one host at the same time.
+ *         The downloaders, the content type probes of all of them and the
+ *         ranges of a segmented media download all take a connection of the
+ *         host from here before they start, so a site is never hit with more
+ *         connections than it allows no matter how the work is split.
+ * 
+ *         How many a host allows is learned while crawling it (AIMD, like TCP
+ *         does with its window). Every host starts at --host-initial-connections.
+ *         While its responses come back about as fast as they used to, every
+ *         finished transfer adds 1/limit, so the limit grows by about one per
+ *         round of transfers, up to --host-connections. When the host answers
+ *         429 or 503, times out, or takes more than twice as long as usual
+ *         to send the first byte, the limit is halved. A Retry-After header
+ *         is left to the circuit breaker of the host, which parks its urls
+ *         until then instead of keeping the threads waiting here.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "hostlimiter.h"
+#include <algorithm>
+
+using clock_type = chrono::steady_clock;
+
+// A first byte this much slower than the usual one is a latency spike
+static const double LATENCY_SPIKE = 2.0;
+
+// Latencies under this are never treated as a spike, they are just noise
+static const double MIN_SPIKE_SECONDS = 0.05;
+
+// How fast the usual latency follows the measured ones
+static const double BASELINE_WEIGHT = 0.1;
+
+host_limiter::host_limiter(int max_per_host, int initial_per_host):
+    max_per_host(max(1, max_per_host)), initial_per_host(max(1, min(initial_per_host, max_per_host))),
+    increases(0), decreases(0) {}
+
+void host_limiter::configure(int max_per_host, int initial_per_host) {
+    lock_guard<mutex> lock(hosts_mutex);
+    this->max_per_host = max(1, max_per_host);
+    this->initial_per_host = max(1, min(initial_per_host, this->max_per_host));
+}
+
+host_limiter::host_state& host_limiter::state_of(const string& host) {
+    auto it = hosts.find(host);
+    if (it == hosts.end()) {
+        it = hosts.emplace(host, host_state()).first;
+        it->second.limit = initial_per_host;
+    }
+    return it->second;
+}
+
+bool host_limiter::has_room(host_state& state) {
+    return state.active < max(1, (int)state.limit);
+}
+
+/**
+ * @brief Waits until the host has a free connection and takes it.
+ * 
+ * @param host The host as returned by url_host.
+ */
+void host_limiter::acquire(const string& host) {
+    unique_lock<mutex> lock(hosts_mutex);
+    host_state& state = state_of(host);
+    while (!has_room(state)) {
+        hosts_cv.wait(lock);
+    }
+    state.active++;
+}
+
+/**
+ * @brief Takes a connection of the host only if one is free right now, used
+ *        for extra work that is not worth waiting for.
+ * 
+ * @return true if a connection was taken and has to be released.
+ */
+bool host_limiter::try_acquire(const string& host) {
+    lock_guard<mutex> lock(hosts_mutex);
+    host_state& state = state_of(host);
+    if (!has_room(state)) {
+        return false;
+    }
+    state.active++;
+    return true;
+}
+
+void host_limiter::release(const string& host) {
+    {
+        lock_guard<mutex> lock(hosts_mutex);
+        state_of(host).active--;
+    }
+    hosts_cv.notify_all();
+}
+
+// Halves the limit, once per round of transfers so one congestion event
+// answered by all the transfers in flight does not cut it to 1
+void host_limiter::cut(host_state& state, clock_type::time_point now) {
+    chrono::duration<double> round(max(state.baseline, MIN_SPIKE_SECONDS));
+    if (now - state.last_cut < round) {
+        return;
+    }
+    state.limit = max(1.0, state.limit / 2);
+    state.last_cut = now;
+    decreases++;
+}
+
+/**
+ * @brief Adjusts the limit of a host after one of its transfers finished.
+ * 
+ * @param host     The host of the transfer.
+ * @param feedback What the transfer saw, see host_feedback.
+ */
+void host_limiter::report(const string& host, const host_feedback& feedback) {
+    clock_type::time_point now = clock_type::now();
+    {
+        lock_guard<mutex> lock(hosts_mutex);
+        host_state& state = state_of(host);
+
+        if (feedback.overloaded) {
+            cut(state, now);
+        } else if (feedback.measured) {
+            bool spike = state.baseline > 0 && feedback.latency > MIN_SPIKE_SECONDS &&
+                         feedback.latency > state.baseline * LATENCY_SPIKE;
+            if (spike) {
+                cut(state, now);
+            } else if (state.limit < max_per_host) {
+                state.limit = min((double)max_per_host, state.limit + 1 / state.limit);
+                increases++;
+            }
+            // A spike moves the usual latency too, a server that got slower
+            // for good is not cut forever
+            state.baseline = state.baseline == 0 ? feedback.latency :
+                             state.baseline + BASELINE_WEIGHT * (feedback.latency - state.baseline);
+        }
+    }
+    hosts_cv.notify_all();
+}
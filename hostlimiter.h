@@ -0,0 +1,72 @@
+// hostlimiter.h
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+
+#ifndef _HOSTLIMITER_H_
+#define _HOSTLIMITER_H_
+
+using namespace std;
+
+// What a finished transfer tells the limiter about its host
+struct host_feedback {
+    bool measured = false;
+    double latency = 0;
+    bool overloaded = false;
+    double retry_after = 0;
+};
+
+class host_limiter {
+private:
+    struct host_state {
+        int active = 0;
+        double limit = 1;
+        double baseline = 0;
+        chrono::steady_clock::time_point last_cut;
+    };
+    unordered_map<string, host_state> hosts;
+    int max_per_host;
+    int initial_per_host;
+    mutex hosts_mutex;
+    condition_variable hosts_cv;
+    atomic<long> increases;
+    atomic<long> decreases;
+    host_state& state_of(const string& host);
+    bool has_room(host_state& state);
+    void cut(host_state& state, chrono::steady_clock::time_point now);
+public:
+    host_limiter(int max_per_host = 6, int initial_per_host = 2);
+    void configure(int max_per_host, int initial_per_host);
+    void acquire(const string& host);
+    bool try_acquire(const string& host);
+    void release(const string& host);
+    void report(const string& host, const host_feedback& feedback);
+    long increase_count() { return increases; }
+    long decrease_count() { return decreases; }
+};
+
+/**
+ * @brief Holds one connection of a host for as long as it is in scope.
+ */
+class host_slot {
+private:
+    host_limiter& limiter;
+    string host;
+public:
+    host_slot(host_limiter& limiter, const string& host): limiter(limiter), host(host) {
+        limiter.acquire(host);
+    }
+    ~host_slot() {
+        limiter.release(host);
+    }
+    void report(const host_feedback& feedback) {
+        limiter.report(host, feedback);
+    }
+    host_slot(const host_slot&) = delete;
+    host_slot& operator=(const host_slot&) = delete;
+};
+
+#endif
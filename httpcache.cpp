@@ -0,0 +1,332 @@
+/**
+ * @file httpcache.cpp
+ * @author Faisal Abdelmonem
+ * @brief  A local HTTP cache on disk, so crawling the same site again (while
+ *         working on the crawler or looking into a problem) does not hit
+ *         the origin for every page. Pages are stored with their status and
+ *         response headers under --http-cache-dir, keyed by the canonical
+ *         url, and a page that is still fresh is served from there without
+ *         any request. The content type probes look here too. Freshness is
+ *         what the server allowed: max-age of Cache-Control or Expires minus
+ *         Date, less the Age the response already had. Responses with
+ *         no-store or no-cache, or without any of these headers, are not
+ *         stored. The cache is kept under --http-cache-size bytes by
+ *         dropping the entries that were used least recently; the last use
+ *         is the modification time of the body file so the order survives a
+ *         restart.
+ * 
+ *         Every entry is two files, <ab>/<fingerprint>.body with the decoded
+ *         body and <ab>/<fingerprint>.meta with the url, the status, the
+ *         headers and when it expires. Both are written by the disk writer
+ *         pool (see diskwriter.cpp) under a temporary name in tmp/ and
+ *         renamed, the entry is only served once both are in place.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "httpcache.h"
+#include "urlutil.h"
+#include "json.hpp"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <strings.h>
+#include <utime.h>
+#include <curl/curl.h>
+
+using json = nlohmann::json;
+namespace fs = filesystem;
+
+http_cache::http_cache(): writer(nullptr), max_size(0), total_size(0), hits(0), stores(0), evictions(0) {}
+
+/**
+ * @brief Opens the cache directory and indexes the entries already in it.
+ *        Files a crash left half written in tmp/ are removed.
+ * 
+ * @param root     The cache directory, created if needed.
+ * @param max_size Bytes the entries may use together.
+ * @param writer   The disk writer pool the entries are written with.
+ * @return true if the directory can be used.
+ */
+bool http_cache::open(const string& root, unsigned long long max_size, disk_writer* writer) {
+    error_code ec;
+    fs::remove_all(root + "/tmp", ec);
+    fs::create_directories(root + "/tmp", ec);
+    if (ec) {
+        return false;
+    }
+    this->root = root;
+    this->writer = writer;
+    this->max_size = max_size;
+
+    // The entries are added from the least to the most recently used
+    vector<pair<fs::file_time_type, pair<string, cache_entry>>> found;
+    for (auto it = fs::recursive_directory_iterator(root, ec); !ec && it != fs::recursive_directory_iterator();
+         it.increment(ec)) {
+        if (it->path().extension() != ".meta") {
+            continue;
+        }
+        ifstream file(it->path());
+        json meta = json::parse(file, nullptr, false);
+        if (meta.is_discarded() || !meta.is_object()) {
+            continue;
+        }
+        cache_entry entry;
+        entry.path = (it->path().parent_path() / it->path().stem()).string();
+        entry.status = meta.value("status", 0L);
+        entry.headers = meta.value("headers", "");
+        entry.expires = meta.value("expires", (time_t)0);
+        error_code size_ec;
+        entry.size = fs::file_size(entry.path + ".body", size_ec) + fs::file_size(it->path(), size_ec);
+        fs::file_time_type used = fs::last_write_time(entry.path + ".body", size_ec);
+        if (!size_ec) {
+            found.push_back({used, {meta.value("url", ""), entry}});
+        }
+    }
+    sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    lock_guard<mutex> lock(cache_mutex);
+    for (auto& item : found) {
+        insert(item.second.first, item.second.second);
+    }
+    // The size may have been lowered since the last run
+    while (total_size > max_size && !lru.empty()) {
+        remove(lru.back());
+        evictions++;
+    }
+    return true;
+}
+
+/**
+ * @brief Serves a page from the cache if it is there and still fresh.
+ * 
+ * @param url       The url of the page.
+ * @param response  Set to the stored response.
+ * @param with_body false if only the status and headers are needed.
+ * @return true if the response can be used without asking the server.
+ */
+bool http_cache::lookup(const string& url, cached_response& response, bool with_body) {
+    if (!is_open()) {
+        return false;
+    }
+    string key = canonicalize_url(url);
+    string path;
+    {
+        lock_guard<mutex> lock(cache_mutex);
+        auto it = entries.find(key);
+        if (it == entries.end() || it->second.expires <= time(nullptr)) {
+            return false;
+        }
+        response.status = it->second.status;
+        response.headers = it->second.headers;
+        path = it->second.path;
+        lru.splice(lru.begin(), lru, it->second.position);
+    }
+    if (!with_body) {
+        hits++;
+        return true;
+    }
+
+    ifstream file(path + ".body", ios::binary);
+    ostringstream body;
+    body << file.rdbuf();
+    if (!file.good()) {
+        lock_guard<mutex> lock(cache_mutex);
+        remove(key);
+        return false;
+    }
+    response.body = body.str();
+    utime((path + ".body").c_str(), nullptr);
+    hits++;
+    return true;
+}
+
+/**
+ * @brief Stores a response if the server allows it to be reused. The files
+ *        are handed to the disk writer pool, the page is served from the
+ *        cache once both are written.
+ * 
+ * @param url     The url of the page.
+ * @param status  The HTTP status, only 200 responses are stored.
+ * @param headers The response headers as they were received.
+ * @param body    The decoded body.
+ */
+void http_cache::store(const string& url, long status, const string& headers, const string& body) {
+    if (!is_open() || status != 200) {
+        return;
+    }
+    time_t now = time(nullptr);
+    long lifetime = freshness(headers, now);
+    if (lifetime <= 0) {
+        return;
+    }
+
+    // The body is kept decoded so the headers about its encoding do not apply
+    string kept_headers;
+    istringstream lines(headers);
+    string line;
+    while (getline(lines, line)) {
+        if (strncasecmp(line.c_str(), "content-encoding:", 17) != 0 &&
+            strncasecmp(line.c_str(), "content-length:", 15) != 0 &&
+            strncasecmp(line.c_str(), "transfer-encoding:", 18) != 0) {
+            kept_headers += line + "\n";
+        }
+    }
+
+    string key = canonicalize_url(url);
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)url_fingerprint(key));
+    cache_entry entry;
+    entry.path = root + "/" + string(hex, 2) + "/" + hex;
+    entry.status = status;
+    entry.headers = kept_headers;
+    entry.expires = now + lifetime;
+
+    json meta = {
+        {"url", key},
+        {"status", status},
+        {"headers", kept_headers},
+        {"expires", entry.expires}
+    };
+    string meta_text = meta.dump();
+    entry.size = body.size() + meta_text.size();
+    if (entry.size > max_size) {
+        return;
+    }
+
+    // Two threads may store the same url at once, each writes its own files.
+    // The meta file goes to the writer thread of the body so it is renamed
+    // after the body, and is only looked at once the body is in place
+    string suffix = ".tmp" + to_string(stores++);
+    string temp = root + "/tmp/" + hex;
+    disk_file* body_file = writer->open(temp + ".body" + suffix);
+    writer->write(body_file, body.data(), body.size());
+    disk_file* meta_file = writer->open(temp + ".meta" + suffix, false, body_file);
+    writer->write(meta_file, meta_text.data(), meta_text.size());
+    auto body_ok = make_shared<atomic<bool>>(false);
+    writer->close(body_file, entry.path + ".body", [body_ok](bool ok) { *body_ok = ok; });
+    writer->close(meta_file, entry.path + ".meta", [this, key, entry, suffix, body_ok](bool ok) {
+        stored(key, entry, suffix, ok && *body_ok);
+    });
+}
+
+// Called from a writer thread once both files of an entry are written
+void http_cache::stored(const string& key, const cache_entry& entry, const string& suffix, bool ok) {
+    lock_guard<mutex> lock(cache_mutex);
+    if (!ok) {
+        // Whatever made it under the final names does not belong together
+        string temp = root + "/tmp/" + fs::path(entry.path).filename().string();
+        error_code ec;
+        remove(key);
+        fs::remove(entry.path + ".body", ec);
+        fs::remove(entry.path + ".meta", ec);
+        fs::remove(temp + ".body" + suffix, ec);
+        fs::remove(temp + ".meta" + suffix, ec);
+        return;
+    }
+    insert(key, entry);
+    while (total_size > max_size && lru.size() > 1) {
+        remove(lru.back());
+        evictions++;
+    }
+}
+
+// Adds an entry as the most recently used one, the lock is held
+void http_cache::insert(const string& key, cache_entry entry) {
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        total_size -= it->second.size;
+        lru.erase(it->second.position);
+        entries.erase(it);
+    }
+    lru.push_front(key);
+    entry.position = lru.begin();
+    total_size += entry.size;
+    entries[key] = entry;
+}
+
+// Drops an entry and its files, the lock is held
+void http_cache::remove(const string& key) {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return;
+    }
+    error_code ec;
+    fs::remove(it->second.path + ".body", ec);
+    fs::remove(it->second.path + ".meta", ec);
+    total_size -= it->second.size;
+    lru.erase(it->second.position);
+    entries.erase(it);
+}
+
+/**
+ * @brief The value of the first header with the given name.
+ * 
+ * @param headers The response headers, one per line.
+ * @param name    The header name without the colon, in any case.
+ * @return string The value without the surrounding spaces, empty if the
+ *                header is not there.
+ */
+string http_cache::header(const string& headers, const string& name) {
+    istringstream lines(headers);
+    string line;
+    while (getline(lines, line)) {
+        if (line.size() > name.size() && line[name.size()] == ':' &&
+            strncasecmp(line.c_str(), name.c_str(), name.size()) == 0) {
+            size_t start = line.find_first_not_of(" \t", name.size() + 1);
+            size_t end = line.find_last_not_of(" \t\r");
+            if (start == string::npos || end < start) {
+                return "";
+            }
+            return line.substr(start, end - start + 1);
+        }
+    }
+    return "";
+}
+
+/**
+ * @brief How many more seconds a response may be used without asking the
+ *        server again.
+ * 
+ * @param headers The response headers.
+ * @param now     When the response was received.
+ * @return long The seconds left, 0 or less if it must not be reused.
+ */
+long http_cache::freshness(const string& headers, time_t now) {
+    string cache_control = header(headers, "cache-control");
+    transform(cache_control.begin(), cache_control.end(), cache_control.begin(), ::tolower);
+    if (cache_control.find("no-store") != string::npos || cache_control.find("no-cache") != string::npos) {
+        return 0;
+    }
+
+    long lifetime = 0;
+    size_t max_age = cache_control.find("max-age=");
+    if (max_age != string::npos) {
+        lifetime = strtol(cache_control.c_str() + max_age + 8, nullptr, 10);
+    } else {
+        string expires = header(headers, "expires");
+        if (expires.empty()) {
+            return 0;
+        }
+        // An Expires that is not a date means already expired
+        time_t expires_at = curl_getdate(expires.c_str(), nullptr);
+        if (expires_at == -1) {
+            return 0;
+        }
+        string date = header(headers, "date");
+        time_t date_at = date.empty() ? -1 : curl_getdate(date.c_str(), nullptr);
+        lifetime = expires_at - (date_at == -1 ? now : date_at);
+    }
+
+    string age = header(headers, "age");
+    if (!age.empty()) {
+        lifetime -= strtol(age.c_str(), nullptr, 10);
+    }
+    return lifetime;
+}
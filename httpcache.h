@@ -0,0 +1,58 @@
+// httpcache.h
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+#include "diskwriter.h"
+
+#ifndef _HTTPCACHE_H_
+#define _HTTPCACHE_H_
+
+using namespace std;
+
+// A response served from the cache
+struct cached_response {
+    long status = 0;
+    string headers;
+    string body;
+};
+
+class http_cache {
+private:
+    struct cache_entry {
+        string path;
+        long status = 0;
+        string headers;
+        time_t expires = 0;
+        unsigned long long size = 0;
+        list<string>::iterator position;
+    };
+    string root;
+    disk_writer* writer;
+    unsigned long long max_size;
+    unsigned long long total_size;
+    unordered_map<string, cache_entry> entries;
+    list<string> lru;
+    mutex cache_mutex;
+    atomic<long> hits;
+    atomic<long> stores;
+    atomic<long> evictions;
+    void insert(const string& key, cache_entry entry);
+    void remove(const string& key);
+    void stored(const string& key, const cache_entry& entry, const string& suffix, bool ok);
+public:
+    http_cache();
+    bool open(const string& root, unsigned long long max_size, disk_writer* writer);
+    bool is_open() { return !root.empty(); }
+    bool lookup(const string& url, cached_response& response, bool with_body = true);
+    void store(const string& url, long status, const string& headers, const string& body);
+    static string header(const string& headers, const string& name);
+    static long freshness(const string& headers, time_t now);
+    long hit_count() { return hits; }
+    long store_count() { return stores; }
+    long eviction_count() { return evictions; }
+};
+
+#endif
@@ -58,6 +58,7 @@ void Logger::log(LogType type, const std::string& message) {
     std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", now);
 
     // Log to the output stream
+    lock_guard<mutex> lock(log_mutex);
     switch (type) {
         case LogType::INFO:
             if (log_console) {
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <ctime>
 #include <memory>
+#include <mutex>
 
 #ifndef _LOGGER_H_
 #define _LOGGER_H_
@@ -17,6 +18,7 @@ class Logger {
 private:
     ofstream file; // File stream if logging to a file
     bool log_console;
+    mutex log_mutex; // Downloaders and writer threads log at the same time
 public:
     Logger() {} // Default constructor for console output
     Logger(const std::string& file_name);
@@ -19,6 +19,7 @@
 #include "urlsmanager.h"
 #include "downloader.h"
 #include "logger.h"
+#include "crawlconfig.h"
 #include <gumbo.h>
 #include <filesystem>
 #include <iostream>
@@ -31,6 +32,7 @@
 #include <functional>
 #include <assert.h>
 #include <deque>
+#include <vector>
 #include "json.hpp"
 
 using json = nlohmann::json;
@@ -40,19 +42,37 @@ namespace fs = filesystem;
 
 int main(int argc, char* argv[]) {
     string log_file;
+    crawl_config config;
+    vector<string> positional_args;
 
-    if (argc == 3) {
-        log_file = argv[2];
+    // Options look like --name=value and can be given anywhere after the program
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            size_t eq = arg.find('=');
+            string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+            string value = eq == string::npos ? "" : arg.substr(eq + 1);
+            if (!config.set(name, value)) {
+                cerr << "Invalid option: " << arg << endl;
+                return 1;
+            }
+        } else {
+            positional_args.emplace_back(arg);
+        }
+    }
+
+    if (positional_args.size() == 2) {
+        log_file = positional_args[1];
     }
     
     Logger logger(log_file);
 
-    if (argc != 2 && argc != 3) {
-        cerr << "Usage: " << argv[0] << " <json_file>" << "log_file" << endl;
+    if (positional_args.size() != 1 && positional_args.size() != 2) {
+        cerr << "Usage: " << argv[0] << " <json_file> [log_file] [--option=value ...]" << endl;
         return 1;
     }
 
-    string json_file_path = argv[1];
+    string json_file_path = positional_args[0];
 
     // Read json from file
     ifstream file(json_file_path);
@@ -75,7 +95,7 @@ int main(int argc, char* argv[]) {
     fs::create_directory("contents");
 
     {
-        urlsmanager url_manager(url_depth_list, &logger); 
+        urlsmanager url_manager(url_depth_list, &logger, config); 
 
       // The destructor of myUrlsManager will be automatically called when this block exits
     } // The join in the destructor ensures that the thread has completed before the object is destroyed
@@ -0,0 +1,414 @@
+/**
+ * @file mediastore.cpp
+ * @author Faisal Abdelmonem
+ * @brief  The images, audios and videos we download are stored by the hash of
+ *         their content instead of by their file name. Saving them under their
+ *         base name made different files with the same name overwrite each
+ *         other, and the logo and favicon of a site were saved again for every
+ *         page that has them. While a file streams in we write it to a
+ *         temporary file and feed every chunk to a SHA-256 hash. When the
+ *         transfer is done the file is renamed to objects/<ab>/<digest> under
+ *         the contents directory, unless a blob with that digest is already
+ *         there in which case the copy is dropped. An index file maps every
+ *         url we stored to its digest so a url is never downloaded twice, not
+ *         even across runs. The writing itself is done by the disk writer
+ *         pool, the downloader only hashes the data and hands it over.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "mediastore.h"
+#include "urlutil.h"
+#include "json.hpp"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = filesystem;
+using json = nlohmann::json;
+
+/**
+ * @brief Construct a new media_store object, open has to be called before
+ *        it is used.
+ * 
+ * @param root The directory the store lives in.
+ */
+media_store::media_store(const string& root): root(root), writer(nullptr), temp_counter(0), stored_blobs(0), duplicate_blobs(0) {}
+
+/**
+ * @brief Creates the directories of the store and reads the url to digest
+ *        index written by earlier runs. Every line of the index is a url and
+ *        its digest separated by a tab.
+ * 
+ * @param writer The disk writer pool the blobs are written with.
+ * @return true if the index was read.
+ * @return false if there is none yet.
+ */
+bool media_store::open(disk_writer* writer) {
+    this->writer = writer;
+    error_code ec;
+    fs::create_directories(root + "/objects", ec);
+    fs::create_directories(root + "/tmp", ec);
+    fs::create_directories(root + "/partial", ec);
+
+    ifstream index(root + "/index.tsv");
+    if (!index.is_open()) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(index_mutex);
+    string line;
+    while (getline(index, line)) {
+        size_t tab = line.find('\t');
+        if (tab != string::npos) {
+            url_digests[line.substr(0, tab)] = line.substr(tab + 1);
+        }
+    }
+    return true;
+}
+
+void media_store::add_to_index(const string& url, const string& digest) {
+    lock_guard<mutex> lock(index_mutex);
+    url_digests[url] = digest;
+    ofstream index(root + "/index.tsv", ios::app);
+    index << url << '\t' << digest << '\n';
+}
+
+/**
+ * @brief Checks whether the content of a url is already in the store.
+ * 
+ * @param url    The canonical url.
+ * @param digest Set to the digest of the stored content.
+ * @return true if the url was stored and its blob still exists.
+ * @return false if it needs to be downloaded.
+ */
+bool media_store::lookup(const string& url, string& digest) {
+    lock_guard<mutex> lock(index_mutex);
+    auto it = url_digests.find(url);
+    if (it == url_digests.end() || !fs::exists(blob_path(it->second))) {
+        return false;
+    }
+    digest = it->second;
+    return true;
+}
+
+/**
+ * @brief Returns where the blob with the given digest is stored. The first
+ *        two characters of the digest are used as a directory so no single
+ *        directory ends up with all the files.
+ */
+string media_store::blob_path(const string& digest) {
+    return root + "/objects/" + digest.substr(0, 2) + "/" + digest;
+}
+
+/**
+ * @brief Returns a new name in the tmp directory of the store for a file
+ *        that is still being downloaded.
+ */
+string media_store::temp_path() {
+    return root + "/tmp/" + to_string(getpid()) + "-" + to_string(temp_counter++) + ".part";
+}
+
+// Turns a finished hash into the hex digest the blobs are named by
+static string hex_digest(EVP_MD_CTX* hash) {
+    unsigned char value[EVP_MAX_MD_SIZE];
+    unsigned int value_size = 0;
+    EVP_DigestFinal_ex(hash, value, &value_size);
+
+    static const char hex[] = "0123456789abcdef";
+    string digest;
+    for (unsigned int i = 0; i < value_size; i++) {
+        digest += hex[value[i] >> 4];
+        digest += hex[value[i] & 0xf];
+    }
+    return digest;
+}
+
+/**
+ * @brief Marks a digest as on its way to disk unless a blob with that digest
+ *        is stored already or about to be.
+ * 
+ * @return true if the caller has to store the blob.
+ * @return false if it is a duplicate.
+ */
+bool media_store::claim_digest(const string& digest) {
+    lock_guard<mutex> lock(index_mutex);
+    if (pending_digests.count(digest) > 0 || fs::exists(blob_path(digest))) {
+        return false;
+    }
+    pending_digests.insert(digest);
+    return true;
+}
+
+/**
+ * @brief Starts storing the content of a url by opening a temporary file for
+ *        it and starting its hash.
+ * 
+ * @param url      The url that is being downloaded.
+ * @param transfer The state of the transfer that write and commit need.
+ * @return true if the transfer could be started.
+ * @return false otherwise.
+ */
+bool media_store::begin(const string& url, media_transfer& transfer) {
+    transfer.store = this;
+    transfer.url = url;
+    transfer.bytes = 0;
+    transfer.temp_path = temp_path();
+    transfer.file = writer->open(transfer.temp_path);
+
+    transfer.hash = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(transfer.hash, EVP_sha256(), nullptr);
+    return true;
+}
+
+/**
+ * @brief Hands a chunk of the content to the disk writer and adds it to the
+ *        hash. Called from the libcurl write callback.
+ * 
+ * @param wait false on the fetch engine thread, see disk_writer::write.
+ * @return size_t The number of bytes written.
+ */
+size_t media_store::write(media_transfer& transfer, const void* data, size_t size, bool wait) {
+    writer->write(transfer.file, data, size, wait);
+    EVP_DigestUpdate(transfer.hash, data, size);
+    transfer.bytes += size;
+    return size;
+}
+
+/**
+ * @brief Tells the store how large the content will be when the server sent
+ *        a Content-Length, so the space for the file is reserved up front.
+ * 
+ * @param transfer The transfer started with begin.
+ * @param size     The announced size of the body in bytes.
+ */
+void media_store::expect_size(media_transfer& transfer, unsigned long long size) {
+    if (transfer.file && transfer.bytes == 0 && size > 0) {
+        writer->preallocate(transfer.file, size);
+    }
+}
+
+/**
+ * @brief Finishes a transfer, moving the temporary file to the blob named by
+ *        its digest or dropping it when that blob already exists. The url is
+ *        added to the index once the blob is on disk.
+ * 
+ * @param transfer The transfer started with begin.
+ * @param digest   Set to the hex SHA-256 digest of the content.
+ * @return true if the content is (or is about to be) in the store.
+ * @return false otherwise.
+ */
+bool media_store::commit(media_transfer& transfer, string& digest) {
+    digest = hex_digest(transfer.hash);
+    EVP_MD_CTX_free(transfer.hash);
+    transfer.hash = nullptr;
+
+    // A blob with the same digest may still be on its way to disk
+    string path = blob_path(digest);
+    if (!claim_digest(digest)) {
+        writer->discard(transfer.file);
+        transfer.file = nullptr;
+        duplicate_blobs++;
+        add_to_index(transfer.url, digest);
+        return true;
+    }
+
+    string url = transfer.url;
+    writer->close(transfer.file, path, [this, url, digest](bool ok) {
+        if (ok) {
+            add_to_index(url, digest);
+        }
+        lock_guard<mutex> lock(index_mutex);
+        pending_digests.erase(digest);
+    });
+    transfer.file = nullptr;
+    stored_blobs++;
+    return true;
+}
+
+/**
+ * @brief Drops a transfer that failed, nothing is added to the store.
+ */
+void media_store::abort(media_transfer& transfer) {
+    if (transfer.hash) {
+        EVP_MD_CTX_free(transfer.hash);
+        transfer.hash = nullptr;
+    }
+    if (transfer.file) {
+        writer->discard(transfer.file);
+        transfer.file = nullptr;
+    }
+}
+
+/**
+ * @brief Adds a file that was downloaded without going through begin and
+ *        write, like a media file fetched in ranges written at their offsets.
+ *        Its content can only be hashed once all of it is on disk so the file
+ *        is read back here, then it is renamed to its blob or dropped as a
+ *        duplicate like in commit. The file has to be synced already.
+ * 
+ * @param url    The url the content was downloaded from.
+ * @param path   The complete file, usually named with temp_path.
+ * @param digest Set to the hex SHA-256 digest of the content.
+ * @return true if the content is in the store.
+ * @return false if the file could not be read or moved.
+ */
+bool media_store::adopt(const string& url, const string& path, string& digest) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    EVP_MD_CTX* hash = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(hash, EVP_sha256(), nullptr);
+    vector<char> buffer(1 << 20);
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        EVP_DigestUpdate(hash, buffer.data(), file.gcount());
+    }
+    bool read_ok = file.eof();
+    file.close();
+    digest = hex_digest(hash);
+    EVP_MD_CTX_free(hash);
+    if (!read_ok) {
+        ::unlink(path.c_str());
+        return false;
+    }
+
+    if (!claim_digest(digest)) {
+        ::unlink(path.c_str());
+        duplicate_blobs++;
+        add_to_index(url, digest);
+        return true;
+    }
+
+    string blob = blob_path(digest);
+    error_code ec;
+    fs::create_directories(fs::path(blob).parent_path(), ec);
+    bool ok = ::rename(path.c_str(), blob.c_str()) == 0;
+    if (ok) {
+        int dir = ::open(fs::path(blob).parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+        if (dir >= 0) {
+            fsync(dir);
+            ::close(dir);
+        }
+        add_to_index(url, digest);
+        stored_blobs++;
+    } else {
+        ::unlink(path.c_str());
+    }
+    lock_guard<mutex> lock(index_mutex);
+    pending_digests.erase(digest);
+    return ok;
+}
+
+/**
+ * @brief Returns where the partial file of a url is kept between attempts,
+ *        its sidecar has the same name with .json instead of .part.
+ */
+string media_store::partial_path(const string& url) {
+    stringstream name;
+    name << hex << setw(16) << setfill('0') << url_fingerprint(canonicalize_url(url));
+    return root + "/partial/" + name.str() + ".part";
+}
+
+static string sidecar_path(const string& partial_path) {
+    return partial_path.substr(0, partial_path.size() - 5) + ".json";
+}
+
+/**
+ * @brief Reads the sidecar of an unfinished download of the url, written by
+ *        an earlier attempt of this run or of an earlier one.
+ * 
+ * @param url     The url of the media file.
+ * @param partial Set to what is known about the download.
+ * @return true if there is a partial file that can be resumed.
+ */
+bool media_store::load_partial(const string& url, media_partial& partial) {
+    string path = partial_path(url);
+    ifstream file(sidecar_path(path));
+    if (!file.is_open() || !fs::exists(path)) {
+        return false;
+    }
+    json data = json::parse(file, nullptr, false);
+    if (data.is_discarded() || !data.is_object() || data.value("url", "") != url) {
+        return false;
+    }
+
+    partial.url = url;
+    partial.path = path;
+    partial.etag = data.value("etag", "");
+    partial.last_modified = data.value("last_modified", "");
+    partial.length = data.value("length", 0LL);
+    partial.missing.clear();
+    for (const json& range : data.value("missing", json::array())) {
+        partial.missing.emplace_back(range[0].get<long long>(), range[1].get<long long>());
+    }
+    return partial.length > 0 && !partial.missing.empty();
+}
+
+/**
+ * @brief Writes the sidecar of a partial file. It is written to a temporary
+ *        file first so a crash never leaves half a sidecar behind.
+ */
+bool media_store::save_partial(const media_partial& partial) {
+    json missing = json::array();
+    for (const auto& range : partial.missing) {
+        missing.push_back({range.first, range.second});
+    }
+    json data = {
+        {"url", partial.url},
+        {"etag", partial.etag},
+        {"last_modified", partial.last_modified},
+        {"length", partial.length},
+        {"missing", missing}
+    };
+
+    string path = sidecar_path(partial.path);
+    {
+        ofstream file(path + ".tmp");
+        if (!file.is_open()) {
+            return false;
+        }
+        file << data;
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return ::rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+/**
+ * @brief Removes a partial file and its sidecar, when it was completed or
+ *        when the content on the server changed.
+ */
+void media_store::drop_partial(const media_partial& partial) {
+    ::unlink(sidecar_path(partial.path).c_str());
+    ::unlink(partial.path.c_str());
+}
+
+/**
+ * @brief Keeps what a failed transfer wrote instead of discarding it. The
+ *        file is moved to the partial path and its sidecar written once all
+ *        of it is on disk, the next attempt only asks for what is missing.
+ * 
+ * @param transfer The transfer started with begin.
+ * @param partial  The validators and the missing range of the download.
+ */
+void media_store::suspend(media_transfer& transfer, const media_partial& partial) {
+    if (transfer.hash) {
+        EVP_MD_CTX_free(transfer.hash);
+        transfer.hash = nullptr;
+    }
+    writer->close(transfer.file, partial.path, [this, partial](bool ok) {
+        if (ok) {
+            save_partial(partial);
+        }
+    });
+    transfer.file = nullptr;
+}
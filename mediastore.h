@@ -0,0 +1,71 @@
+// mediastore.h
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <openssl/evp.h>
+#include "diskwriter.h"
+
+#ifndef _MEDIASTORE_H_
+#define _MEDIASTORE_H_
+
+using namespace std;
+
+class media_store;
+
+struct media_transfer {
+    media_store* store = nullptr;
+    string url;
+    string temp_path;
+    disk_file* file = nullptr;
+    EVP_MD_CTX* hash = nullptr;
+    long long bytes = 0;
+};
+
+// A download that did not finish and can be resumed, saved next to the
+// partial file so it survives the process
+struct media_partial {
+    string url;
+    string path;
+    string etag;
+    string last_modified;
+    long long length = 0;
+    vector<pair<long long, long long>> missing;
+};
+
+class media_store {
+private:
+    string root;
+    disk_writer* writer;
+    unordered_map<string, string> url_digests;
+    unordered_set<string> pending_digests;
+    mutex index_mutex;
+    atomic<long> temp_counter;
+    atomic<long> stored_blobs;
+    atomic<long> duplicate_blobs;
+    void add_to_index(const string& url, const string& digest);
+    bool claim_digest(const string& digest);
+public:
+    media_store(const string& root = "contents");
+    bool open(disk_writer* writer);
+    bool lookup(const string& url, string& digest);
+    string blob_path(const string& digest);
+    string temp_path();
+    bool begin(const string& url, media_transfer& transfer);
+    size_t write(media_transfer& transfer, const void* data, size_t size, bool wait = true);
+    void expect_size(media_transfer& transfer, unsigned long long size);
+    bool commit(media_transfer& transfer, string& digest);
+    void abort(media_transfer& transfer);
+    bool adopt(const string& url, const string& path, string& digest);
+    string partial_path(const string& url);
+    bool load_partial(const string& url, media_partial& partial);
+    bool save_partial(const media_partial& partial);
+    void drop_partial(const media_partial& partial);
+    void suspend(media_transfer& transfer, const media_partial& partial);
+    long stored_count() { return stored_blobs; }
+    long duplicate_count() { return duplicate_blobs; }
+};
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * @file packextract.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Command line tool to get the text back out of a pack written with
+ *         --text-output=pack. It can list the urls in the pack, print the
+ *         text of one url, or write every page to its own file in a
+ *         directory like the crawler used to do.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "packfile.h"
+#include "urlutil.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+namespace fs = filesystem;
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4) {
+        cerr << "Usage: " << argv[0] << " <pack_dir> --list" << endl;
+        cerr << "       " << argv[0] << " <pack_dir> <url>" << endl;
+        cerr << "       " << argv[0] << " <pack_dir> --all <out_dir>" << endl;
+        return 1;
+    }
+
+    pack_reader reader;
+    if (!reader.open(argv[1])) {
+        cerr << "Error opening pack: " << argv[1] << endl;
+        return 1;
+    }
+
+    string command = argv[2];
+    if (command == "--list") {
+        string url;
+        for (size_t i = 0; i < reader.size(); i++) {
+            if (reader.url_at(i, url)) {
+                cout << url << "\n";
+            }
+        }
+    } else if (command == "--all" && argc == 4) {
+        fs::create_directories(argv[3]);
+        string url, data;
+        for (size_t i = 0; i < reader.size(); i++) {
+            if (!reader.url_at(i, url) || !reader.data_at(i, data)) {
+                cerr << "Could not read entry " << i << endl;
+                continue;
+            }
+            // Named by fingerprint, urls do not make safe or unique file names
+            stringstream name;
+            name << hex << setw(16) << setfill('0') << url_fingerprint(url) << ".txt";
+            ofstream file(string(argv[3]) + "/" + name.str(), ios::binary);
+            file << data;
+            cout << name.str() << "\t" << url << "\n";
+        }
+    } else {
+        string data;
+        // The pack stores every page under its canonical url
+        if (!reader.read(canonicalize_url(command), data)) {
+            cerr << "URL not in pack: " << command << endl;
+            return 1;
+        }
+        cout << data;
+    }
+
+    return 0;
+}
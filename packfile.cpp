@@ -0,0 +1,313 @@
+/**
+ * @file packfile.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Instead of one small file per page the text can be written to pack
+ *         files. A pack is a directory with large append only segment files
+ *         (pack-00000.seg, pack-00001.seg, ...) and one index file pack.idx.
+ *         Every page is appended to the current segment as a record made of
+ *         a small header (the length of the url and of the text), the url and
+ *         the text, and then an entry pointing to that record is appended to
+ *         the index. The index is an array of fixed size entries so a reader
+ *         can map it into memory and use it as is. The record is always
+ *         written before its index entry, so the index never points at data
+ *         that is not there. When a segment grows past the maximum size the
+ *         next page starts a new one, and every run starts a new segment
+ *         after the ones that already exist. The writes themselves are
+ *         handed to the disk writer pool, the segment and the index are
+ *         kept on the same writer thread so their writes stay in order.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "packfile.h"
+#include "urlutil.h"
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = filesystem;
+
+// Size of the header in front of every record, the url length and the data length
+static const uint64_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+/**
+ * @brief Returns the path of a segment file of the pack in the given directory.
+ */
+string pack_segment_name(const string& directory, uint32_t segment) {
+    char name[32];
+    snprintf(name, sizeof(name), "pack-%05u.seg", segment);
+    return directory + "/" + name;
+}
+
+/**
+ * @brief Construct a new pack_writer object, nothing is written until open
+ *        is called.
+ */
+pack_writer::pack_writer(): max_segment_size(0), segment(0), segment_size(0), writer(nullptr),
+    segment_file(nullptr), index_file(nullptr) {}
+
+pack_writer::~pack_writer() {
+    close();
+}
+
+bool pack_writer::open_segment(uint32_t number) {
+    if (segment_file) {
+        writer->close(segment_file);
+    }
+    segment = number;
+    segment_size = 0;
+    segment_file = writer->open(pack_segment_name(directory, segment), false, index_file);
+    return true;
+}
+
+/**
+ * @brief Opens the pack in the given directory for appending. The pages of
+ *        this run go to a new segment after the existing ones.
+ * 
+ * @param directory        The directory of the pack, created if needed.
+ * @param max_segment_size Size after which a new segment is started.
+ * @param writer           The disk writer pool the pack is written with.
+ * @return true if the pack could be opened.
+ * @return false otherwise.
+ */
+bool pack_writer::open(const string& directory, uint64_t max_segment_size, disk_writer* writer) {
+    lock_guard<mutex> lock(pack_mutex);
+    this->directory = directory;
+    this->max_segment_size = max_segment_size;
+    this->writer = writer;
+
+    error_code ec;
+    fs::create_directories(directory, ec);
+    if (ec) {
+        return false;
+    }
+
+    uint32_t next_segment = 0;
+    while (fs::exists(pack_segment_name(directory, next_segment))) {
+        next_segment++;
+    }
+
+    // A crash can leave half an entry at the end of the index, it is cut off
+    // so the entries of this run are appended in line with the others
+    string index_path = directory + "/pack.idx";
+    uintmax_t index_size = fs::file_size(index_path, ec);
+    if (!ec && index_size % sizeof(pack_index_entry) != 0) {
+        fs::resize_file(index_path, index_size / sizeof(pack_index_entry) * sizeof(pack_index_entry), ec);
+        if (ec) {
+            return false;
+        }
+    }
+
+    index_file = writer->open(index_path, true);
+    return open_segment(next_segment);
+}
+
+/**
+ * @brief Appends the text of a page to the pack. The page is stored under
+ *        its canonical url, which is what readers look up.
+ * 
+ * @param page_url The url of the page.
+ * @param data     The text of the page.
+ * @return true if the record and its index entry were handed to the writer.
+ * @return false otherwise.
+ */
+bool pack_writer::append(const string& page_url, const string& data) {
+    string url = canonicalize_url(page_url);
+    lock_guard<mutex> lock(pack_mutex);
+    if (!segment_file || !index_file) {
+        return false;
+    }
+
+    uint64_t record_size = RECORD_HEADER_SIZE + url.size() + data.size();
+    if (segment_size > 0 && segment_size + record_size > max_segment_size && !open_segment(segment + 1)) {
+        return false;
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    uint32_t url_length = url.size();
+    uint64_t data_length = data.size();
+    memcpy(header, &url_length, sizeof(url_length));
+    memcpy(header + sizeof(url_length), &data_length, sizeof(data_length));
+
+    writer->write(segment_file, header, sizeof(header));
+    writer->write(segment_file, url.data(), url.size());
+    writer->write(segment_file, data.data(), data.size());
+    // The record has to be queued before the index entry that points to it
+    writer->flush(segment_file);
+
+    pack_index_entry entry;
+    entry.fingerprint = url_fingerprint(url);
+    entry.segment = segment;
+    entry.url_length = url_length;
+    entry.offset = segment_size;
+    entry.length = data_length;
+    segment_size += record_size;
+
+    writer->write(index_file, &entry, sizeof(entry));
+    return true;
+}
+
+/**
+ * @brief Closes the current segment and the index.
+ */
+void pack_writer::close() {
+    lock_guard<mutex> lock(pack_mutex);
+    if (segment_file) {
+        writer->close(segment_file);
+        segment_file = nullptr;
+    }
+    if (index_file) {
+        writer->close(index_file);
+        index_file = nullptr;
+    }
+}
+
+/**
+ * @brief Construct a new pack_reader object, open has to be called before
+ *        anything can be read.
+ */
+pack_reader::pack_reader(): entries(nullptr), entry_count(0), index_size(0) {}
+
+pack_reader::~pack_reader() {
+    if (entries) {
+        munmap((void*)entries, index_size);
+    }
+    for (int fd : segment_fds) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+/**
+ * @brief Maps the index of the pack in the given directory into memory.
+ * 
+ * @param directory The directory of the pack.
+ * @return true if the index could be mapped (an empty pack is fine too).
+ * @return false otherwise.
+ */
+bool pack_reader::open(const string& directory) {
+    this->directory = directory;
+
+    int fd = ::open((directory + "/pack.idx").c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // A crash can leave half an entry at the end, it is ignored here and cut
+    // off by the next pack_writer::open
+    entry_count = info.st_size / sizeof(pack_index_entry);
+    index_size = entry_count * sizeof(pack_index_entry);
+    if (index_size > 0) {
+        void* mapped = mmap(nullptr, index_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            entry_count = 0;
+            index_size = 0;
+            return false;
+        }
+        entries = (const pack_index_entry*)mapped;
+    }
+    ::close(fd);
+
+    // Entries with the same fingerprint stay in the order they were written
+    by_fingerprint.resize(entry_count);
+    iota(by_fingerprint.begin(), by_fingerprint.end(), 0);
+    stable_sort(by_fingerprint.begin(), by_fingerprint.end(), [this](size_t a, size_t b) {
+        return entries[a].fingerprint < entries[b].fingerprint;
+    });
+    return true;
+}
+
+int pack_reader::segment_fd(uint32_t segment) {
+    if (segment >= segment_fds.size()) {
+        segment_fds.resize(segment + 1, -1);
+    }
+    if (segment_fds[segment] < 0) {
+        segment_fds[segment] = ::open(pack_segment_name(directory, segment).c_str(), O_RDONLY);
+    }
+    return segment_fds[segment];
+}
+
+static bool read_all(int fd, char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t got = pread(fd, data, size, offset);
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+        offset += got;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the url of the i-th entry of the index.
+ */
+bool pack_reader::url_at(size_t i, string& url) {
+    if (i >= entry_count) {
+        return false;
+    }
+    const pack_index_entry& entry = entries[i];
+    int fd = segment_fd(entry.segment);
+    url.resize(entry.url_length);
+    return fd >= 0 && read_all(fd, &url[0], url.size(), entry.offset + RECORD_HEADER_SIZE);
+}
+
+/**
+ * @brief Reads the text of the i-th entry of the index.
+ */
+bool pack_reader::data_at(size_t i, string& data) {
+    if (i >= entry_count) {
+        return false;
+    }
+    const pack_index_entry& entry = entries[i];
+    int fd = segment_fd(entry.segment);
+    data.resize(entry.length);
+    return fd >= 0 && read_all(fd, &data[0], data.size(), entry.offset + RECORD_HEADER_SIZE + entry.url_length);
+}
+
+/**
+ * @brief Reads the text stored for a url. If the url was written more than
+ *        once (by several runs) the latest text is returned. The entries are
+ *        found by a binary search of the fingerprints sorted when the pack
+ *        was opened.
+ * 
+ * @param url  The canonical url of the page.
+ * @param data Set to the text of the page.
+ * @return true if the url is in the pack.
+ * @return false otherwise.
+ */
+bool pack_reader::read(const string& url, string& data) {
+    uint64_t fingerprint = url_fingerprint(url);
+    auto first = lower_bound(by_fingerprint.begin(), by_fingerprint.end(), fingerprint,
+                             [this](size_t i, uint64_t value) { return entries[i].fingerprint < value; });
+    auto last = first;
+    while (last != by_fingerprint.end() && entries[*last].fingerprint == fingerprint) {
+        ++last;
+    }
+    // The latest entry of the url is the last one with its fingerprint
+    for (auto it = last; it != first;) {
+        --it;
+        string stored_url;
+        if (url_at(*it, stored_url) && stored_url == url) {
+            return data_at(*it, data);
+        }
+    }
+    return false;
+}
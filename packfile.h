@@ -0,0 +1,62 @@
+// packfile.h
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include "diskwriter.h"
+
+#ifndef _PACKFILE_H_
+#define _PACKFILE_H_
+
+using namespace std;
+
+// One entry of pack.idx, the index is just an array of these
+struct pack_index_entry {
+    uint64_t fingerprint;
+    uint32_t segment;
+    uint32_t url_length;
+    uint64_t offset;
+    uint64_t length;
+};
+
+class pack_writer {
+private:
+    string directory;
+    uint64_t max_segment_size;
+    uint32_t segment;
+    uint64_t segment_size;
+    disk_writer* writer;
+    disk_file* segment_file;
+    disk_file* index_file;
+    mutex pack_mutex;
+    bool open_segment(uint32_t number);
+public:
+    pack_writer();
+    ~pack_writer();
+    bool open(const string& directory, uint64_t max_segment_size, disk_writer* writer);
+    bool append(const string& url, const string& data);
+    void close();
+};
+
+class pack_reader {
+private:
+    string directory;
+    const pack_index_entry* entries;
+    size_t entry_count;
+    size_t index_size;
+    vector<size_t> by_fingerprint;
+    vector<int> segment_fds;
+    int segment_fd(uint32_t segment);
+public:
+    pack_reader();
+    ~pack_reader();
+    bool open(const string& directory);
+    size_t size() { return entry_count; }
+    bool url_at(size_t i, string& url);
+    bool data_at(size_t i, string& data);
+    bool read(const string& url, string& data);
+};
+
+string pack_segment_name(const string& directory, uint32_t segment);
+
+#endif
@@ -0,0 +1,192 @@
+/**
+ * @file probecache.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Remembers what the content type probes found out about a url so the
+ *         same url is not probed twice, neither later in the crawl nor (when
+ *         a cache file is given) in the next run. Failures are remembered as
+ *         well: a url that answered 404 or 410 is a negative entry, and when
+ *         the host of a url could not be resolved or connected to the whole
+ *         host gets a negative entry so none of its urls are tried until it
+ *         expires. Negative entries expire a lot sooner than positive ones.
+ *         The cache has a fixed capacity and drops the least recently used
+ *         entries when it is full. It is split in shards with their own lock
+ *         because all the probe threads of all the downloaders use it at once.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "probecache.h"
+#include "urlutil.h"
+#include "json.hpp"
+#include <fstream>
+#include <functional>
+
+using json = nlohmann::json;
+
+// Host failures are kept next to the urls under keys no url can have
+static const string HOST_KEY_PREFIX = "host:";
+
+/**
+ * @brief Construct a new probe_cache object.
+ * 
+ * @param capacity     The maximum number of entries kept.
+ * @param positive_ttl Seconds a successful probe stays valid.
+ * @param negative_ttl Seconds a failed probe stays valid.
+ */
+probe_cache::probe_cache(size_t capacity, time_t positive_ttl, time_t negative_ttl):
+    capacity(capacity), positive_ttl(positive_ttl), negative_ttl(negative_ttl) {}
+
+/**
+ * @brief Changes the limits after construction, used once the command line
+ *        options are known.
+ */
+void probe_cache::configure(size_t capacity, time_t positive_ttl, time_t negative_ttl) {
+    this->capacity = capacity;
+    this->positive_ttl = positive_ttl;
+    this->negative_ttl = negative_ttl;
+}
+
+probe_cache::shard& probe_cache::shard_for(const string& key) {
+    return shards[hash<string>()(key) % SHARDS];
+}
+
+bool probe_cache::lookup_key(const string& key, probe_entry& entry) {
+    shard& s = shard_for(key);
+    lock_guard<mutex> lock(s.shard_mutex);
+
+    auto it = s.entries.find(key);
+    if (it == s.entries.end()) {
+        return false;
+    }
+
+    const probe_entry& cached = it->second.first;
+    time_t ttl = cached.negative ? negative_ttl : positive_ttl;
+    if (time(nullptr) - cached.timestamp > ttl) {
+        s.lru.erase(it->second.second);
+        s.entries.erase(it);
+        return false;
+    }
+
+    // Move the entry to the front, it is now the most recently used one
+    s.lru.splice(s.lru.begin(), s.lru, it->second.second);
+    entry = cached;
+    return true;
+}
+
+void probe_cache::store_key(const string& key, const probe_entry& entry) {
+    shard& s = shard_for(key);
+    lock_guard<mutex> lock(s.shard_mutex);
+
+    auto it = s.entries.find(key);
+    if (it != s.entries.end()) {
+        it->second.first = entry;
+        s.lru.splice(s.lru.begin(), s.lru, it->second.second);
+        return;
+    }
+
+    s.lru.push_front(key);
+    s.entries.emplace(key, make_pair(entry, s.lru.begin()));
+
+    size_t shard_capacity = max((size_t)1, capacity / SHARDS);
+    while (s.entries.size() > shard_capacity) {
+        s.entries.erase(s.lru.back());
+        s.lru.pop_back();
+    }
+}
+
+/**
+ * @brief Looks up what we know about a url. A negative entry for the host of
+ *        the url is returned as well, since no url of that host can work.
+ * 
+ * @param url   The canonical url.
+ * @param entry Set to the cached entry if there is one.
+ * @return true if a valid entry was found.
+ * @return false if the url has to be probed.
+ */
+bool probe_cache::lookup(const string& url, probe_entry& entry) {
+    return lookup_key(HOST_KEY_PREFIX + url_host(url), entry) || lookup_key(url, entry);
+}
+
+/**
+ * @brief Stores the result of probing a url.
+ */
+void probe_cache::store(const string& url, const probe_entry& entry) {
+    store_key(url, entry);
+}
+
+/**
+ * @brief Stores a failure that affects every url of a host, like a host name
+ *        that does not resolve.
+ */
+void probe_cache::store_host_failure(const string& host, const probe_entry& entry) {
+    store_key(HOST_KEY_PREFIX + host, entry);
+}
+
+/**
+ * @brief Loads the entries saved by a previous run, expired ones are skipped.
+ * 
+ * @param file_name The json file the cache was saved to.
+ * @return true if the file was read.
+ * @return false if it does not exist or could not be parsed.
+ */
+bool probe_cache::load(const string& file_name) {
+    ifstream file(file_name);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    json data = json::parse(file, nullptr, false);
+    if (data.is_discarded() || !data.is_array()) {
+        return false;
+    }
+
+    time_t now = time(nullptr);
+    for (const auto& item : data) {
+        probe_entry entry;
+        entry.content_type = item.value("content_type", "");
+        entry.size = item.value("size", -1LL);
+        entry.status = item.value("status", 0L);
+        entry.timestamp = item.value("timestamp", (time_t)0);
+        entry.negative = item.value("negative", false);
+
+        time_t ttl = entry.negative ? negative_ttl : positive_ttl;
+        if (now - entry.timestamp <= ttl) {
+            store_key(item.value("key", ""), entry);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Saves all the entries to a json file so the next run can use them.
+ * 
+ * @param file_name The json file to write.
+ * @return true if the file was written.
+ * @return false otherwise.
+ */
+bool probe_cache::save(const string& file_name) {
+    json data = json::array();
+    for (shard& s : shards) {
+        lock_guard<mutex> lock(s.shard_mutex);
+        for (const auto& item : s.entries) {
+            const probe_entry& entry = item.second.first;
+            data.push_back({
+                {"key", item.first},
+                {"content_type", entry.content_type},
+                {"size", entry.size},
+                {"status", entry.status},
+                {"timestamp", entry.timestamp},
+                {"negative", entry.negative}
+            });
+        }
+    }
+
+    ofstream file(file_name);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << data;
+    return file.good();
+}
@@ -0,0 +1,46 @@
+// probecache.h
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <ctime>
+
+#ifndef _PROBECACHE_H_
+#define _PROBECACHE_H_
+
+using namespace std;
+
+struct probe_entry {
+    string content_type;
+    long long size = -1;
+    long status = 0;
+    time_t timestamp = 0;
+    bool negative = false;
+};
+
+class probe_cache {
+private:
+    static const size_t SHARDS = 16;
+    struct shard {
+        mutex shard_mutex;
+        list<string> lru;
+        unordered_map<string, pair<probe_entry, list<string>::iterator>> entries;
+    };
+    shard shards[SHARDS];
+    size_t capacity;
+    time_t positive_ttl;
+    time_t negative_ttl;
+    shard& shard_for(const string& key);
+    bool lookup_key(const string& key, probe_entry& entry);
+    void store_key(const string& key, const probe_entry& entry);
+public:
+    probe_cache(size_t capacity = 100000, time_t positive_ttl = 86400, time_t negative_ttl = 3600);
+    void configure(size_t capacity, time_t positive_ttl, time_t negative_ttl);
+    bool lookup(const string& url, probe_entry& entry);
+    void store(const string& url, const probe_entry& entry);
+    void store_host_failure(const string& host, const probe_entry& entry);
+    bool load(const string& file_name);
+    bool save(const string& file_name);
+};
+
+#endif
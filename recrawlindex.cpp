@@ -0,0 +1,126 @@
+/**
+ * @file recrawlindex.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Remembers the pages of a crawl so the next crawl of the same seeds
+ *         (with the same --recrawl-file) only downloads what changed. For
+ *         every page we keep the ETag and Last-Modified the server sent, a
+ *         hash of the html and the links found on it. On the next crawl the
+ *         request carries If-None-Match and If-Modified-Since; when the server
+ *         answers 304, or sends a page with the same hash because it does not
+ *         support validators, the page is not parsed again and its stored
+ *         links are followed instead. Media need nothing of this, the media
+ *         store already knows which urls it has.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "recrawlindex.h"
+#include "urlutil.h"
+#include "json.hpp"
+#include <fstream>
+#include <cstdio>
+
+using json = nlohmann::json;
+
+recrawl_index::recrawl_index(): unchanged(0) {}
+
+/**
+ * @brief Finds what the last crawl stored about a page.
+ * 
+ * @param url    The url of the page.
+ * @param record Set to the stored record if there is one.
+ * @return true if the page was crawled before.
+ */
+bool recrawl_index::lookup(const string& url, page_record& record) {
+    lock_guard<mutex> lock(pages_mutex);
+    auto it = pages.find(canonicalize_url(url));
+    if (it == pages.end()) {
+        return false;
+    }
+    record = it->second;
+    return true;
+}
+
+void recrawl_index::store(const string& url, const page_record& record) {
+    lock_guard<mutex> lock(pages_mutex);
+    pages[canonicalize_url(url)] = record;
+}
+
+/**
+ * @brief A hash of the html of a page, enough to tell whether it changed.
+ */
+string recrawl_index::hash_of(const string& content) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)url_fingerprint(content));
+    return hex;
+}
+
+/**
+ * @brief Loads the pages saved by an earlier crawl.
+ * 
+ * @param file_name The json file the index was saved to.
+ * @return true if the file was read.
+ * @return false if there is no such file or it is not an index.
+ */
+bool recrawl_index::load(const string& file_name) {
+    ifstream file(file_name);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    json data = json::parse(file, nullptr, false);
+    if (data.is_discarded() || !data.is_array()) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(pages_mutex);
+    for (const auto& item : data) {
+        page_record record;
+        record.etag = item.value("etag", "");
+        record.last_modified = item.value("last_modified", "");
+        record.content_hash = item.value("content_hash", "");
+        record.outlinks = item.value("outlinks", vector<string>());
+        pages[item.value("url", "")] = record;
+    }
+    return true;
+}
+
+/**
+ * @brief Saves the pages of this crawl, and those of earlier crawls this one
+ *         did not get to, for the next crawl.
+ * 
+ * @param file_name The json file to write.
+ * @return true if the file was written.
+ * @return false otherwise.
+ */
+bool recrawl_index::save(const string& file_name) {
+    json data = json::array();
+    {
+        lock_guard<mutex> lock(pages_mutex);
+        for (const auto& item : pages) {
+            data.push_back({
+                {"url", item.first},
+                {"etag", item.second.etag},
+                {"last_modified", item.second.last_modified},
+                {"content_hash", item.second.content_hash},
+                {"outlinks", item.second.outlinks}
+            });
+        }
+    }
+
+    // Written next to the old index and renamed so a crash keeps the old one
+    string temp_name = file_name + ".tmp";
+    {
+        ofstream file(temp_name);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << data;
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return rename(temp_name.c_str(), file_name.c_str()) == 0;
+}
@@ -0,0 +1,37 @@
+// recrawlindex.h
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#ifndef _RECRAWLINDEX_H_
+#define _RECRAWLINDEX_H_
+
+using namespace std;
+
+// What an earlier crawl learned about a page
+struct page_record {
+    string etag;
+    string last_modified;
+    string content_hash;
+    vector<string> outlinks;
+};
+
+class recrawl_index {
+private:
+    unordered_map<string, page_record> pages;
+    mutex pages_mutex;
+    atomic<long> unchanged;
+public:
+    recrawl_index();
+    bool lookup(const string& url, page_record& record);
+    void store(const string& url, const page_record& record);
+    void count_unchanged() { unchanged++; }
+    long unchanged_count() { return unchanged; }
+    static string hash_of(const string& content);
+    bool load(const string& file_name);
+    bool save(const string& file_name);
+};
+
+#endif
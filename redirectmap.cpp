@@ -0,0 +1,136 @@
+/**
+ * @file redirectmap.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Remembers where urls redirect to. libcurl follows the redirects of
+ *         every transfer (up to --max-redirects of them) and the url a
+ *         transfer ended up at is recorded here under the url it started
+ *         from. Links to a url that is known to redirect are rewritten to
+ *         the target before they are claimed, so the target is what gets
+ *         deduplicated and fetched and the redirect itself is not requested
+ *         again. Permanent redirects (301 and 308) are kept in --redirect-file
+ *         for the next crawls; temporary ones only for this crawl.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "redirectmap.h"
+#include "urlutil.h"
+#include "json.hpp"
+#include <fstream>
+#include <cstdio>
+
+using json = nlohmann::json;
+
+// Longer chains than this are taken as a loop
+static const int MAX_CHAIN = 10;
+
+redirect_map::redirect_map(): rewritten(0) {}
+
+/**
+ * @brief Finds where a url ends up.
+ * 
+ * @param url Any url.
+ * @return string The canonical target if the url is known to redirect,
+ *                otherwise the url itself.
+ */
+string redirect_map::resolve(const string& url) {
+    lock_guard<mutex> lock(redirects_mutex);
+    if (redirects.empty()) {
+        return url;
+    }
+    string current = canonicalize_url(url);
+    bool found = false;
+    for (int hops = 0; hops < MAX_CHAIN; hops++) {
+        auto it = redirects.find(current);
+        if (it == redirects.end()) {
+            break;
+        }
+        current = it->second.target;
+        found = true;
+    }
+    if (!found) {
+        return url;
+    }
+    rewritten++;
+    return current;
+}
+
+/**
+ * @brief Records that a url redirected.
+ * 
+ * @param url       The url the transfer started from.
+ * @param target    The url it ended up at.
+ * @param permanent true if every hop was a 301 or 308.
+ */
+void redirect_map::record(const string& url, const string& target, bool permanent) {
+    string source = canonicalize_url(url);
+    string destination = canonicalize_url(target);
+    if (source == destination) {
+        return;
+    }
+    lock_guard<mutex> lock(redirects_mutex);
+    redirect& entry = redirects[source];
+    entry.target = destination;
+    entry.permanent = permanent;
+}
+
+size_t redirect_map::size() {
+    lock_guard<mutex> lock(redirects_mutex);
+    return redirects.size();
+}
+
+/**
+ * @brief Loads the permanent redirects saved by an earlier crawl.
+ * 
+ * @param file_name The json file the redirects were saved to.
+ * @return true if the file was read.
+ */
+bool redirect_map::load(const string& file_name) {
+    ifstream file(file_name);
+    if (!file.is_open()) {
+        return false;
+    }
+    json data = json::parse(file, nullptr, false);
+    if (data.is_discarded() || !data.is_object()) {
+        return false;
+    }
+    lock_guard<mutex> lock(redirects_mutex);
+    for (const auto& item : data.items()) {
+        if (item.value().is_string()) {
+            redirects[item.key()] = {item.value().get<string>(), true};
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Saves the permanent redirects for the next crawl.
+ * 
+ * @param file_name The json file to write.
+ * @return true if the file was written.
+ */
+bool redirect_map::save(const string& file_name) {
+    json data = json::object();
+    {
+        lock_guard<mutex> lock(redirects_mutex);
+        for (const auto& item : redirects) {
+            if (item.second.permanent) {
+                data[item.first] = item.second.target;
+            }
+        }
+    }
+    string temp_name = file_name + ".tmp";
+    {
+        ofstream file(temp_name);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << data;
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return rename(temp_name.c_str(), file_name.c_str()) == 0;
+}
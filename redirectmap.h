@@ -0,0 +1,31 @@
+// redirectmap.h
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#ifndef _REDIRECTMAP_H_
+#define _REDIRECTMAP_H_
+
+using namespace std;
+
+class redirect_map {
+private:
+    struct redirect {
+        string target;
+        bool permanent = false;
+    };
+    unordered_map<string, redirect> redirects;
+    mutex redirects_mutex;
+    atomic<long> rewritten;
+public:
+    redirect_map();
+    string resolve(const string& url);
+    void record(const string& url, const string& target, bool permanent);
+    long rewritten_count() { return rewritten; }
+    size_t size();
+    bool load(const string& file_name);
+    bool save(const string& file_name);
+};
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file retrypolicy.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Decides which failed transfers are worth another try and how long
+ *         to wait before it. Errors that say something about the connection
+ *         or a busy server (timeouts, resets, 429, 5xx) are retried, errors
+ *         that say something about the url (404, a malformed url) are not.
+ *         The wait doubles with every attempt and is drawn at random below
+ *         that ("full jitter") so the threads that failed on the same server
+ *         at the same moment do not all come back at the same moment either.
+ *         A Retry-After from the server is the least we wait, up to
+ *         --retry-max-ms; a longer one holds the host in its circuit
+ *         breaker and the url is parked instead of waited for.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "retrypolicy.h"
+#include <algorithm>
+#include <random>
+
+retry_policy::retry_policy(): max_retries(3), base_ms(500), max_ms(30000) {}
+
+void retry_policy::configure(int max_retries, int base_ms, int max_ms) {
+    this->max_retries = max(0, max_retries);
+    this->base_ms = max(1, base_ms);
+    this->max_ms = max(this->base_ms, max_ms);
+}
+
+/**
+ * @brief Tells whether a failed transfer may succeed when tried again. These
+ *        are also the failures that count against the circuit breaker of
+ *        the host.
+ * 
+ * @param res    What curl_easy_perform returned.
+ * @param status The HTTP status of the response, 0 if there was none.
+ */
+bool retry_policy::retryable(CURLcode res, long status) {
+    switch (res) {
+        case CURLE_OK:
+            break;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return true;
+        default:
+            return false;
+    }
+    return status == 408 || status == 429 || status == 500 || status == 502 ||
+           status == 503 || status == 504;
+}
+
+/**
+ * @brief How long to wait before the given retry.
+ * 
+ * @param attempt     0 for the first retry.
+ * @param retry_after Seconds the server asked us to wait, 0 if it did not.
+ * @return chrono::milliseconds The wait, never longer than --retry-max-ms.
+ */
+chrono::milliseconds retry_policy::delay(int attempt, double retry_after) const {
+    static thread_local mt19937 random(random_device{}());
+    long long ceiling = min((long long)max_ms, (long long)base_ms << min(attempt, 20));
+    uniform_int_distribution<long long> jitter(0, ceiling);
+    long long asked = (long long)min(retry_after * 1000, (double)max_ms);
+    long long wait = max(jitter(random), asked);
+    return chrono::milliseconds(wait);
+}
@@ -0,0 +1,24 @@
+// retrypolicy.h
+#include <string>
+#include <chrono>
+#include <curl/curl.h>
+
+#ifndef _RETRYPOLICY_H_
+#define _RETRYPOLICY_H_
+
+using namespace std;
+
+class retry_policy {
+private:
+    int max_retries;
+    int base_ms;
+    int max_ms;
+public:
+    retry_policy();
+    void configure(int max_retries, int base_ms, int max_ms);
+    int retries() const { return max_retries; }
+    static bool retryable(CURLcode res, long status);
+    chrono::milliseconds delay(int attempt, double retry_after) const;
+};
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * @file schemeupgrade.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Remembers the hosts that are only served over https so their
+ *         http:// links are rewritten to https:// before they are queued,
+ *         instead of costing a request that only answers with a redirect.
+ *         A host gets here when it sends a Strict-Transport-Security header
+ *         over https (for max-age seconds, and its subdomains too with
+ *         includeSubDomains) or when a page of it answered with a permanent
+ *         redirect to the same url over https. Addresses are never upgraded,
+ *         HSTS does not apply to them. With --hsts-file the hosts are kept
+ *         for the next crawls.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "schemeupgrade.h"
+#include "urlutil.h"
+#include "json.hpp"
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <arpa/inet.h>
+
+using json = nlohmann::json;
+
+// The host of a canonical url without the user and the port
+static string host_name(const string& url) {
+    string host = url_host(url);
+    size_t user_end = host.rfind('@');
+    if (user_end != string::npos) {
+        host = host.substr(user_end + 1);
+    }
+    if (!host.empty() && host[0] == '[') {
+        return "";
+    }
+    host = host.substr(0, host.find(':'));
+    unsigned char address[sizeof(struct in_addr)];
+    if (inet_pton(AF_INET, host.c_str(), address) == 1) {
+        return "";
+    }
+    return host;
+}
+
+scheme_upgrades::scheme_upgrades(): upgraded(0) {}
+
+/**
+ * @brief Rewrites an http url to https if its host is known to need it.
+ * 
+ * @param url Any url.
+ * @return string The https url, or the url unchanged.
+ */
+string scheme_upgrades::upgrade(const string& url) {
+    string canonical = canonicalize_url(url);
+    if (canonical.compare(0, 7, "http://") != 0) {
+        return url;
+    }
+    string name = host_name(canonical);
+    if (name.empty()) {
+        return url;
+    }
+
+    lock_guard<mutex> lock(hosts_mutex);
+    if (hosts.empty()) {
+        return url;
+    }
+    time_t now = time(nullptr);
+    // The host itself, then every parent domain that covers its subdomains
+    for (size_t start = 0; start != string::npos; ) {
+        auto it = hosts.find(name.substr(start));
+        if (it != hosts.end() && (start == 0 || it->second.subdomains) &&
+            (it->second.expires == 0 || it->second.expires > now)) {
+            upgraded++;
+            return "https://" + canonical.substr(7);
+        }
+        start = name.find('.', start);
+        if (start != string::npos) {
+            start++;
+        }
+    }
+    return url;
+}
+
+/**
+ * @brief Takes in a Strict-Transport-Security header.
+ * 
+ * @param url   The url of the response that carried it, it only counts if
+ *              that was https.
+ * @param value The value of the header.
+ */
+void scheme_upgrades::observe_hsts(const string& url, const string& value) {
+    string canonical = canonicalize_url(url);
+    string name = host_name(canonical);
+    if (canonical.compare(0, 8, "https://") != 0 || name.empty()) {
+        return;
+    }
+    string directives = value;
+    transform(directives.begin(), directives.end(), directives.begin(), ::tolower);
+    size_t max_age = directives.find("max-age=");
+    if (max_age == string::npos) {
+        return;
+    }
+    size_t digits = max_age + 8 + (directives[max_age + 8] == '"' ? 1 : 0);
+    long seconds = strtol(directives.c_str() + digits, nullptr, 10);
+
+    lock_guard<mutex> lock(hosts_mutex);
+    // max-age=0 is how a host takes it back
+    if (seconds <= 0) {
+        hosts.erase(name);
+        return;
+    }
+    upgrade_entry& entry = hosts[name];
+    entry.expires = time(nullptr) + seconds;
+    entry.subdomains = directives.find("includesubdomains") != string::npos;
+}
+
+/**
+ * @brief Takes in a permanent redirect, one from http to the same url over
+ *        https means the host wants https for good.
+ * 
+ * @param url    The url the transfer started from.
+ * @param target Where it was redirected to.
+ */
+void scheme_upgrades::observe_redirect(const string& url, const string& target) {
+    string source = canonicalize_url(url);
+    string destination = canonicalize_url(target);
+    if (source.compare(0, 7, "http://") != 0 || destination != "https://" + source.substr(7)) {
+        return;
+    }
+    string name = host_name(source);
+    if (name.empty()) {
+        return;
+    }
+    lock_guard<mutex> lock(hosts_mutex);
+    // An HSTS entry already says for how long
+    hosts.emplace(name, upgrade_entry());
+}
+
+size_t scheme_upgrades::size() {
+    lock_guard<mutex> lock(hosts_mutex);
+    return hosts.size();
+}
+
+/**
+ * @brief Loads the hosts saved by an earlier crawl.
+ * 
+ * @param file_name The json file the hosts were saved to.
+ * @return true if the file was read.
+ */
+bool scheme_upgrades::load(const string& file_name) {
+    ifstream file(file_name);
+    if (!file.is_open()) {
+        return false;
+    }
+    json data = json::parse(file, nullptr, false);
+    if (data.is_discarded() || !data.is_array()) {
+        return false;
+    }
+    time_t now = time(nullptr);
+    lock_guard<mutex> lock(hosts_mutex);
+    for (const auto& item : data) {
+        upgrade_entry entry;
+        entry.expires = item.value("expires", (time_t)0);
+        entry.subdomains = item.value("subdomains", false);
+        if (entry.expires == 0 || entry.expires > now) {
+            hosts[item.value("host", "")] = entry;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Saves the hosts for the next crawl.
+ * 
+ * @param file_name The json file to write.
+ * @return true if the file was written.
+ */
+bool scheme_upgrades::save(const string& file_name) {
+    json data = json::array();
+    {
+        lock_guard<mutex> lock(hosts_mutex);
+        for (const auto& item : hosts) {
+            data.push_back({
+                {"host", item.first},
+                {"expires", item.second.expires},
+                {"subdomains", item.second.subdomains}
+            });
+        }
+    }
+    string temp_name = file_name + ".tmp";
+    {
+        ofstream file(temp_name);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << data;
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return rename(temp_name.c_str(), file_name.c_str()) == 0;
+}
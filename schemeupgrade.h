@@ -0,0 +1,33 @@
+// schemeupgrade.h
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <ctime>
+
+#ifndef _SCHEMEUPGRADE_H_
+#define _SCHEMEUPGRADE_H_
+
+using namespace std;
+
+class scheme_upgrades {
+private:
+    struct upgrade_entry {
+        time_t expires = 0;
+        bool subdomains = false;
+    };
+    unordered_map<string, upgrade_entry> hosts;
+    mutex hosts_mutex;
+    atomic<long> upgraded;
+public:
+    scheme_upgrades();
+    string upgrade(const string& url);
+    void observe_hsts(const string& url, const string& value);
+    void observe_redirect(const string& url, const string& target);
+    long upgraded_count() { return upgraded; }
+    size_t size();
+    bool load(const string& file_name);
+    bool save(const string& file_name);
+};
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file textlayout.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Decides where the text file of a page is saved. The text files used
+ *         to be named after the url with every '.' and '/' removed, so
+ *         different urls like a.b/c and ab/c got the same file, and all of
+ *         them ended up in one directory that gets slow to create and look
+ *         up files in once it holds millions of them. The sharded layout
+ *         names a file by the fingerprint of its canonical url in hex and
+ *         uses the first bytes of that name as a fixed number of directory
+ *         levels, text/3f/a2/3fa2....txt, so every directory stays small. A
+ *         manifest text/manifest.tsv maps the file names back to the urls.
+ *         The flat layout keeps the old names for scripts that expect them.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "textlayout.h"
+#include "urlutil.h"
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+namespace fs = filesystem;
+
+text_layout::text_layout(): root("text"), sharded(true), depth(2) {}
+
+/**
+ * @brief Creates the directories of the layout and opens the manifest in
+ *        append mode so the entries of earlier runs are kept.
+ * 
+ * @param root    The directory the text files are saved in.
+ * @param sharded Whether files are named by fingerprint in a directory tree.
+ * @param depth   How many directory levels of two hex characters are used.
+ * @return true if the layout can be written to.
+ */
+bool text_layout::open(const string& root, bool sharded, int depth) {
+    this->root = root;
+    this->sharded = sharded;
+    this->depth = max(0, min(depth, 8));
+
+    error_code ec;
+    fs::create_directories(root + "/tmp", ec);
+    if (!sharded) {
+        return !ec;
+    }
+    manifest.open(root + "/manifest.tsv", ios::app);
+    return manifest.is_open();
+}
+
+/**
+ * @brief Returns the path the text of the given url is saved at.
+ * 
+ * @param url The url of the page.
+ * @return string The path of its text file.
+ */
+string text_layout::file_name(const string& url) {
+    if (!sharded) {
+        string name = url.substr(min((size_t)6, url.size())); //remove https:
+        name.erase(remove(name.begin(), name.end(), '.'), name.end());
+        name.erase(remove(name.begin(), name.end(), '/'), name.end());
+        return root + "/" + name + ".txt";
+    }
+
+    stringstream name;
+    name << hex << setw(16) << setfill('0') << url_fingerprint(canonicalize_url(url));
+    string hex_name = name.str();
+
+    string path = root;
+    for (int level = 0; level < depth; level++) {
+        path += "/" + hex_name.substr(level * 2, 2);
+    }
+    return path + "/" + hex_name + ".txt";
+}
+
+/**
+ * @brief Returns where the text of the url is written before it is complete,
+ *        all temporary files share one directory so the shard directories
+ *        only ever hold finished files.
+ */
+string text_layout::temp_name(const string& url) {
+    return root + "/tmp/" + fs::path(file_name(url)).filename().string() + ".part";
+}
+
+/**
+ * @brief Adds a saved file to the manifest.
+ * 
+ * @param url       The url of the page.
+ * @param file_name The path returned by file_name.
+ */
+void text_layout::record(const string& url, const string& file_name) {
+    if (!sharded) {
+        return;
+    }
+    lock_guard<mutex> lock(manifest_mutex);
+    manifest << fs::path(file_name).filename().string() << '\t' << url << '\n';
+    manifest.flush();
+}
+
+void text_layout::close() {
+    lock_guard<mutex> lock(manifest_mutex);
+    if (manifest.is_open()) {
+        manifest.close();
+    }
+}
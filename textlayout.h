@@ -0,0 +1,27 @@
+// textlayout.h
+#include <string>
+#include <mutex>
+#include <fstream>
+
+#ifndef _TEXTLAYOUT_H_
+#define _TEXTLAYOUT_H_
+
+using namespace std;
+
+class text_layout {
+private:
+    string root;
+    bool sharded;
+    int depth;
+    ofstream manifest;
+    mutex manifest_mutex;
+public:
+    text_layout();
+    bool open(const string& root, bool sharded, int depth);
+    string file_name(const string& url);
+    string temp_name(const string& url);
+    void record(const string& url, const string& file_name);
+    void close();
+};
+
+#endif
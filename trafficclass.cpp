@@ -0,0 +1,142 @@
+/**
+ * @file trafficclass.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Splits the transfers of the crawl in three classes so the bulk
+ *         downloads do not slow down the discovery of new pages. HTML pages
+ *         (and the content type probes of their links) are downloaded by the
+ *         downloader threads as before. Images and other small assets go to a
+ *         queue of their own with --asset-threads threads, and large media,
+ *         videos and audios or any file we know to be at least
+ *         --large-media-size bytes, to another one with --media-threads
+ *         threads. A downloader never waits for the media of a page, it only
+ *         queues them and moves on to the next page. With --bandwidth set
+ *         every class is assured of its share of it (see bandwidthlimiter.cpp)
+ *         so the media trickle in while the pages keep their speed.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "trafficclass.h"
+#include <algorithm>
+
+traffic_classes::traffic_classes(): pages_done(false), large_media_size(4 << 20) {}
+
+/**
+ * @brief Sets the threads of every class.
+ * 
+ * @param large_media_size Files at least this large are large media.
+ */
+void traffic_classes::configure(int html_threads, int asset_threads, int media_threads,
+                                unsigned long long large_media_size) {
+    of(TrafficClass::HTML).threads = max(1, html_threads);
+    of(TrafficClass::ASSETS).threads = max(1, asset_threads);
+    of(TrafficClass::MEDIA).threads = max(1, media_threads);
+    this->large_media_size = large_media_size;
+}
+
+/**
+ * @brief Picks the class of a media url from what we know before downloading
+ *        it, its size when a probe saw it and otherwise its content type.
+ * 
+ * @param content_type The content type of the url.
+ * @param size         The size reported by a probe, -1 if unknown.
+ * @return TrafficClass ASSETS or MEDIA.
+ */
+TrafficClass traffic_classes::classify(const string& content_type, long long size) {
+    if (size >= 0) {
+        return (unsigned long long)size >= large_media_size ? TrafficClass::MEDIA : TrafficClass::ASSETS;
+    }
+    if (content_type.find("video") != string::npos || content_type.find("audio") != string::npos) {
+        return TrafficClass::MEDIA;
+    }
+    return TrafficClass::ASSETS;
+}
+
+void traffic_classes::push(TrafficClass traffic, const string& url) {
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        of(traffic).urls.push_back(url);
+        of(traffic).queued++;
+    }
+    queue_cv.notify_all();
+}
+
+/**
+ * @brief Puts a url of a class aside until the given time, the media
+ *        threads call this when the circuit breaker of its host does not
+ *        let the download through yet.
+ * 
+ * @param until When the url may be taken again.
+ */
+void traffic_classes::defer(TrafficClass traffic, const string& url, chrono::steady_clock::time_point until) {
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        of(traffic).deferred.emplace_back(url, until);
+    }
+    queue_cv.notify_all();
+}
+
+/**
+ * @brief Takes the next url of a class, waiting for one while pages are
+ *        still being crawled since every page can queue new media. A url
+ *        that was put aside is taken once its time has come.
+ * 
+ * @return true if there is a url to download.
+ * @return false if the queue is empty, nothing is put aside and no page can
+ *         add to it anymore.
+ */
+bool traffic_classes::pop(TrafficClass traffic, string& url) {
+    unique_lock<mutex> lock(queue_mutex);
+    class_queue& queue = of(traffic);
+    while (true) {
+        if (!queue.urls.empty()) {
+            url = queue.urls.front();
+            queue.urls.pop_front();
+            return true;
+        }
+        auto next = queue.deferred.end();
+        for (auto it = queue.deferred.begin(); it != queue.deferred.end(); ++it) {
+            if (next == queue.deferred.end() || it->second < next->second) {
+                next = it;
+            }
+        }
+        if (next == queue.deferred.end()) {
+            if (pages_done) {
+                return false;
+            }
+            queue_cv.wait(lock);
+        } else if (next->second <= chrono::steady_clock::now()) {
+            url = next->first;
+            queue.deferred.erase(next);
+            return true;
+        } else {
+            queue_cv.wait_until(lock, next->second);
+        }
+    }
+}
+
+/**
+ * @brief Called once all the pages are crawled, the media threads exit when
+ *        their queues are empty.
+ */
+void traffic_classes::finish_pages() {
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        pages_done = true;
+    }
+    queue_cv.notify_all();
+}
+
+string traffic_classes::name(TrafficClass traffic) {
+    switch (traffic) {
+        case TrafficClass::HTML:
+            return "html";
+        case TrafficClass::ASSETS:
+            return "assets";
+        case TrafficClass::MEDIA:
+            return "media";
+    }
+    return "";
+}
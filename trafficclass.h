@@ -0,0 +1,45 @@
+// trafficclass.h
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#ifndef _TRAFFICCLASS_H_
+#define _TRAFFICCLASS_H_
+
+using namespace std;
+
+// The kinds of transfers that get their own threads and bandwidth share
+enum class TrafficClass { HTML, ASSETS, MEDIA };
+
+class traffic_classes {
+private:
+    struct class_queue {
+        deque<string> urls;
+        deque<pair<string, chrono::steady_clock::time_point>> deferred;
+        int threads = 1;
+        atomic<long> queued{0};
+    };
+    class_queue classes[3];
+    mutex queue_mutex;
+    condition_variable queue_cv;
+    bool pages_done;
+    unsigned long long large_media_size;
+    class_queue& of(TrafficClass traffic) { return classes[(int)traffic]; }
+public:
+    traffic_classes();
+    void configure(int html_threads, int asset_threads, int media_threads,
+                   unsigned long long large_media_size);
+    TrafficClass classify(const string& content_type, long long size);
+    int threads(TrafficClass traffic) { return of(traffic).threads; }
+    void push(TrafficClass traffic, const string& url);
+    void defer(TrafficClass traffic, const string& url, chrono::steady_clock::time_point until);
+    bool pop(TrafficClass traffic, string& url);
+    void finish_pages();
+    long queued_count(TrafficClass traffic) { return of(traffic).queued; }
+    static string name(TrafficClass traffic);
+};
+
+#endif
@@ -0,0 +1,248 @@
+/**
+ * @file typepredictor.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Guesses the content type of a url without asking the server. Most
+ *         of the links we classify are obvious from the url alone (everything
+ *         under wp-content/uploads ending in .png is an image) so we start
+ *         from a table of well known file extensions. An entry of the table
+ *         is only used for a host once a probe of that host agreed with it,
+ *         and never again for the host once a probe disagreed. On top of
+ *         that we learn, for every host, which content type the urls of a given shape
+ *         turned out to have. The shape of a url is its host, its first path
+ *         segment and the kind of ending it has (an extension, a trailing
+ *         slash or neither). Once enough probes of a shape agreed with each
+ *         other we trust that shape and stop probing it. Every so often a
+ *         predicted url is probed anyway so a shape that changes is noticed.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "typepredictor.h"
+#include "urlutil.h"
+#include <algorithm>
+#include <cctype>
+
+// One in this many predictions is still probed to keep the learned shapes honest
+static const long VERIFY_EVERY = 50;
+
+static const unordered_map<string, string> extension_types = {
+    {"png", "image/png"}, {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"}, {"webp", "image/webp"}, {"bmp", "image/bmp"},
+    {"ico", "image/x-icon"}, {"svg", "image/svg+xml"}, {"avif", "image/avif"},
+    {"mp4", "video/mp4"}, {"m4v", "video/x-m4v"}, {"webm", "video/webm"},
+    {"mov", "video/quicktime"}, {"avi", "video/x-msvideo"}, {"mkv", "video/x-matroska"},
+    {"mp3", "audio/mpeg"}, {"wav", "audio/wav"}, {"ogg", "audio/ogg"},
+    {"m4a", "audio/mp4"}, {"flac", "audio/flac"}, {"aac", "audio/aac"},
+    {"html", "text/html"}, {"htm", "text/html"}, {"css", "text/css"},
+    {"js", "application/javascript"}, {"json", "application/json"},
+    {"pdf", "application/pdf"}, {"xml", "application/xml"}
+};
+
+/**
+ * @brief Strips the parameters (like "; charset=UTF-8") from a content type
+ *        and lower cases it so the same type is always counted the same way.
+ */
+static string mime_type(const string& content_type) {
+    string mime = content_type.substr(0, content_type.find(';'));
+    mime.erase(remove_if(mime.begin(), mime.end(), ::isspace), mime.end());
+    transform(mime.begin(), mime.end(), mime.begin(), ::tolower);
+    return mime;
+}
+
+/**
+ * @brief Returns the lower cased extension of the last path segment of the
+ *        url or an empty string if it does not have one.
+ */
+static string url_extension(const string& path) {
+    string last = path.substr(path.find_last_of('/') + 1);
+    size_t dot = last.find_last_of('.');
+    if (dot == string::npos || dot + 1 == last.size()) {
+        return "";
+    }
+    string extension = last.substr(dot + 1);
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+/**
+ * @brief Returns the path of the url without the query string and fragment.
+ *        A '/' in the query of a url without a path ("https://host?a=/b")
+ *        is not the start of its path.
+ */
+static string url_path(const string& url) {
+    size_t scheme_end = url.find("://");
+    size_t authority_start = scheme_end == string::npos ? 0 : scheme_end + 3;
+    size_t path_end = url.find_first_of("?#", authority_start);
+    size_t path_start = url.find('/', authority_start);
+    if (path_start == string::npos || path_start > path_end) {
+        return "/";
+    }
+    return url.substr(path_start, path_end - path_start);
+}
+
+/**
+ * @brief The key of the extension table entry of a url on its host, empty
+ *        if the table has no entry for the extension of the url.
+ */
+static string extension_key(const string& url, string& content_type) {
+    string extension = url_extension(url_path(url));
+    auto it = extension_types.find(extension);
+    if (it == extension_types.end()) {
+        return "";
+    }
+    content_type = it->second;
+    return url_host(url) + "/*." + extension;
+}
+
+/**
+ * @brief Construct a new type_predictor object.
+ * 
+ * @param min_samples    How many probes of a url shape we need before we
+ *                       trust what we learned about it.
+ * @param min_confidence The share of those probes that have to agree on one
+ *                       content type.
+ */
+type_predictor::type_predictor(int min_samples, double min_confidence):
+    min_samples(min_samples), min_confidence(min_confidence),
+    predictions(0), hits(0), misses(0), mispredictions(0) {}
+
+/**
+ * @brief Changes the thresholds after construction, used once the command
+ *        line options are known.
+ */
+void type_predictor::configure(int min_samples, double min_confidence) {
+    this->min_samples = min_samples;
+    this->min_confidence = min_confidence;
+}
+
+/**
+ * @brief Builds the shape of a url that we learn content types for. Every
+ *        png under example.com/wp-content/ has the same shape, and so does
+ *        every top level page of example.com that ends with a slash.
+ */
+string type_predictor::pattern_key(const string& url) {
+    string path = url_path(url);
+    string extension = url_extension(path);
+
+    string ending;
+    if (!extension.empty()) {
+        ending = "*." + extension;
+    } else if (path.back() == '/') {
+        ending = "*/";
+    } else {
+        ending = "*";
+    }
+
+    // Only keep the first segment when there is more than one, otherwise
+    // every page at the top of the site would be a shape of its own
+    size_t second_slash = path.find('/', 1);
+    string prefix;
+    if (second_slash != string::npos && second_slash + 1 < path.size()) {
+        prefix = path.substr(0, second_slash);
+    }
+
+    return url_host(url) + prefix + "/" + ending;
+}
+
+/**
+ * @brief Predicts the content type of a url. What we learned about the shape
+ *        of the url wins over its extension; if the probes of that shape did
+ *        not agree enough we do not predict at all. The extension is only
+ *        used once the host confirmed it, see observe.
+ * 
+ * @param url          The url we need the content type of.
+ * @param content_type Set to the predicted content type, also when the url
+ *                     is picked to verify the prediction with a probe.
+ * @return true if the prediction is confident enough to skip the probe.
+ * @return false if the url has to be probed.
+ */
+bool type_predictor::predict(const string& url, string& content_type) {
+    string prediction;
+    {
+        lock_guard<mutex> lock(patterns_mutex);
+        auto it = patterns.find(pattern_key(url));
+        if (it != patterns.end() && it->second.total >= min_samples) {
+            auto best = max_element(it->second.type_counts.begin(), it->second.type_counts.end(),
+                [](const pair<const string, int>& a, const pair<const string, int>& b) {
+                    return a.second < b.second;
+                });
+            if (best->second >= min_confidence * it->second.total) {
+                prediction = best->first;
+            } else {
+                misses++;
+                return false;
+            }
+        }
+
+        string extension_type;
+        string key = prediction.empty() ? extension_key(url, extension_type) : "";
+        auto rule = key.empty() ? extension_rules.end() : extension_rules.find(key);
+        if (rule != extension_rules.end() && rule->second.confirmed && !rule->second.disabled) {
+            prediction = extension_type;
+        }
+    }
+
+    if (prediction.empty()) {
+        misses++;
+        return false;
+    }
+
+    // Handing out the prediction on a verification probe lets the caller
+    // tell us whether it was right with record_verification
+    content_type = prediction;
+    if (++predictions % VERIFY_EVERY == 0) {
+        misses++;
+        return false;
+    }
+
+    hits++;
+    return true;
+}
+
+/**
+ * @brief Records the content type a probe found for a url so that urls of
+ *        the same shape can be predicted later on. A probe that agrees with
+ *        the extension table turns its entry on for the host, one that does
+ *        not turns it off for the host for good.
+ * 
+ * @param url          The url that was probed.
+ * @param content_type The Content-Type header the server answered with.
+ */
+void type_predictor::observe(const string& url, const string& content_type) {
+    if (content_type.empty()) {
+        return;
+    }
+
+    string key = pattern_key(url);
+    string extension_type;
+    string extension = extension_key(url, extension_type);
+    string mime = mime_type(content_type);
+    lock_guard<mutex> lock(patterns_mutex);
+    pattern_stats& stats = patterns[key];
+    stats.type_counts[mime]++;
+    stats.total++;
+
+    if (!extension.empty()) {
+        extension_rule& rule = extension_rules[extension];
+        if (mime == extension_type) {
+            rule.confirmed = true;
+        } else {
+            rule.disabled = true;
+        }
+    }
+}
+
+/**
+ * @brief Counts a misprediction when a url we could have predicted was probed
+ *        anyway and the server disagreed with the prediction.
+ * 
+ * @param predicted What predict would have returned.
+ * @param actual    What the probe found.
+ */
+void type_predictor::record_verification(const string& predicted, const string& actual) {
+    if (!actual.empty() && mime_type(predicted) != mime_type(actual)) {
+        mispredictions++;
+    }
+}
@@ -0,0 +1,44 @@
+// typepredictor.h
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#ifndef _TYPEPREDICTOR_H_
+#define _TYPEPREDICTOR_H_
+
+using namespace std;
+
+class type_predictor {
+private:
+    struct pattern_stats {
+        unordered_map<string, int> type_counts;
+        int total = 0;
+    };
+    // What the probes of a host said about one entry of the extension table
+    struct extension_rule {
+        bool confirmed = false;
+        bool disabled = false;
+    };
+    unordered_map<string, pattern_stats> patterns;
+    unordered_map<string, extension_rule> extension_rules;
+    mutex patterns_mutex;
+    int min_samples;
+    double min_confidence;
+    atomic<long> predictions;
+    atomic<long> hits;
+    atomic<long> misses;
+    atomic<long> mispredictions;
+    string pattern_key(const string& url);
+public:
+    type_predictor(int min_samples = 3, double min_confidence = 0.9);
+    void configure(int min_samples, double min_confidence);
+    bool predict(const string& url, string& content_type);
+    void observe(const string& url, const string& content_type);
+    void record_verification(const string& predicted, const string& actual);
+    long hit_count() { return hits; }
+    long miss_count() { return misses; }
+    long misprediction_count() { return mispredictions; }
+};
+
+#endif
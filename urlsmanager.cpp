@@ -5,13 +5,16 @@
  *         The url manager keeps track of all the urls we need to scrape
  *         and their respective depths. As a small optimization I also keep
  *         track of the urls we visited before so that I don't download them
- *         again. The url manager starts 4 downloader threads and when each
+ *         again. The url manager starts 4 downloader threads (--threads on
+ *         the command line changes that) and when each
  *         thread is started it is detached and runs independantly. I chose 4
  *         because it is a number that is less than the number of cores in the
- *         wsl environment and mainly just to show multithreading in the program
- *         however at the end of the day libcurl which I use to perform the get 
- *         requests has some shared state and therefore required synchronization
- *         that makes it appear sequential. After the 4 downloader threads are
+ *         wsl environment and mainly just to show multithreading in the program.
+ *         Every libcurl handle is only ever used by the thread that created it
+ *         so the downloads do not need a lock of their own, only the caches
+ *         the handles share are locked (see curlshare.cpp). The images and
+ *         media the pages link to are downloaded by separate threads of their
+ *         traffic class (see trafficclass.cpp). After the downloader threads are
  *         running each thread asks the url manager for a url to download using
  *         the get_url function and if they ever find urls with depth > 0 they
  *         add them to the url manager using add_url. whenever a downloader
@@ -25,16 +28,67 @@
 
 #include "urlsmanager.h"
 #include "downloader.h"
+#include "urlutil.h"
 
 /**
- * @brief Construct a new urlsmanager::urlsmanager object.
+ * @brief Construct a new urlsmanager::urlsmanager object. The seed urls are
+ *         marked as visited right away so that pages linking back to them
+ *         do not put them in the list a second time.
  * 
  * @param url_list The json parsed list given from the main function that
  *                 we need to scrape.
  * @param logger   The logger that the downloader thread uses to communicate
  *                 back the status of the downloads.
+ * @param config   The crawl options parsed from the command line.
  */
-urlsmanager::urlsmanager(deque<pair<string, int>> url_list, Logger* logger): url_depth_list(url_list), logger(logger) {
+urlsmanager::urlsmanager(deque<pair<string, int>> url_list, Logger* logger, const crawl_config& config):
+    logger(logger), url_depth_list(url_list), busy_pages(0), config(config) {
+    for (const auto& entry : url_depth_list) {
+        visited_before.insert(url_identity(entry.first));
+    }
+    predictor.configure(config.predictor_min_samples, config.predictor_confidence);
+    probes.configure(config.probe_cache_size, config.probe_cache_ttl, config.probe_negative_ttl);
+    hosts.configure(config.host_connections, config.host_initial_connections);
+    traffic.configure(config.downloader_threads, config.asset_threads, config.media_threads,
+                      config.large_media_size);
+    double shares[3] = {config.html_share, config.asset_share, config.media_share};
+    unsigned long long class_limits[3] = {config.html_bandwidth, config.asset_bandwidth, config.media_bandwidth};
+    bandwidth.configure(config.bandwidth, shares, class_limits, config.host_bandwidth);
+    retries.configure(config.retries, config.retry_base_ms, config.retry_max_ms);
+    breakers.configure(config.breaker_failures, config.breaker_open_seconds, config.breaker_trips,
+                       config.max_retry_after);
+    limits.configure(config.max_page_bytes, config.max_media_bytes, config.max_probe_bytes);
+    if (!config.probe_cache_file.empty()) {
+        probes.load(config.probe_cache_file);
+    }
+    if (!config.recrawl_file.empty()) {
+        recrawl.load(config.recrawl_file);
+    }
+    if (!config.redirect_file.empty()) {
+        redirects.load(config.redirect_file);
+    }
+    if (!config.hsts_file.empty()) {
+        upgrades.load(config.hsts_file);
+    }
+    if (!writer.start(config.writer_threads, config.writer_memory, config.durable_writes,
+                      config.group_commit_ms, config.writer_backend == "io_uring")) {
+        log(LogType::ERROR, "io_uring is not available, writing outputs with pwrite instead");
+    }
+    media.open(&writer);
+    if (!config.http_cache_dir.empty() && !cache.open(config.http_cache_dir, config.http_cache_size, &writer)) {
+        log(LogType::ERROR, "Could not open the HTTP cache in " + config.http_cache_dir);
+    }
+    if (config.text_output == "pack" && !pack.open("text", config.pack_segment_size, &writer)) {
+        log(LogType::ERROR, "Could not open the text pack in text/");
+    }
+    if (config.text_output == "files" &&
+        !texts.open("text", config.text_layout == "sharded", config.shard_depth)) {
+        log(LogType::ERROR, "Could not open the text manifest in text/");
+    }
+    if (!config.warc_directory.empty() &&
+        !warc.open(config.warc_directory, config.warc_compression, config.warc_segment_size, &writer)) {
+        log(LogType::ERROR, "Could not open the WARC output in " + config.warc_directory);
+    }
     url_manager_thread = thread(&urlsmanager::start, this);
 }
 
@@ -53,43 +107,199 @@ urlsmanager::~urlsmanager() {
 /**
  * @brief Function that the downloader thread uses when it finds a url
  *        that it should visit next. if the depth is zero then we are
- *        not required download the content at that url.
+ *        not required download the content at that url. The url is
+ *        expected to have been claimed with claim_unvisited already so
+ *        we do not check the visited urls again here.
  * 
  * @param url Url to be downloaded next.
  * @param depth Depth of the url we will download.
  */
 void urlsmanager::add_url(string& url, int depth) {
-    std::lock_guard<std::mutex> lock(mutex);  // Lock to ensure thread safety
-
-    if (depth <= 0) return; // Make sure you are not adding a url with depth le 0
-    auto it = find(visited_before.begin(), visited_before.end(), url);
+    {
+        std::lock_guard<std::mutex> lock(lists_mutex);  // Lock to ensure thread safety
 
-    // Haven't seen this url before
-    if (it == visited_before.end()) {
-        visited_before.emplace_back(url);
+        if (depth <= 0) return; // Make sure you are not adding a url with depth le 0
         url_depth_list.emplace_back(url, depth);
     }
+    lists_cv.notify_one();
+}
+
+/**
+ * @brief The downloader threads collect all the links of a page first and
+ *        call this function once with all of them before they classify any.
+ *        Every url that no thread has seen before is marked as visited and
+ *        returned, so each link is classified and downloaded by exactly one
+ *        thread no matter how many pages link to it. Duplicates inside the
+ *        given list are dropped as well. A link whose probe fails for a
+ *        reason that may go away is given back with unclaim.
+ *        The claim is what keeps two threads from fetching the same url at
+ *        the same time: its probe, its parking and its page or media
+ *        download all happen under the one claim, so concurrent pages that
+ *        link to it never start a second transfer.
+ * 
+ * @param urls The links found on a page.
+ * @return vector<string> The canonical form of the links nobody claimed before.
+ */
+vector<string> urlsmanager::claim_unvisited(const vector<string>& urls) {
+    std::lock_guard<std::mutex> lock(lists_mutex);
+
+    vector<string> claimed;
+    for (const string& url : urls) {
+        string canonical = canonicalize_url(url);
+        if (visited_before.insert(url_identity(canonical)).second) {
+            claimed.emplace_back(canonical);
+        }
+    }
+    return claimed;
+}
+
+/**
+ * @brief Gives up the claim on a url whose content type could not be found
+ *        for a reason that may go away, so the next page that links to it
+ *        claims and probes it again. Only called once the probe finished
+ *        and nothing was done with its answer, so the next claim never
+ *        overlaps a transfer of the url.
+ * 
+ * @param url The canonical url as returned by claim_unvisited.
+ */
+void urlsmanager::unclaim(const string& url) {
+    std::lock_guard<std::mutex> lock(lists_mutex);
+    visited_before.erase(url_identity(canonicalize_url(url)));
 }
 
 /**
  * @brief When the downloader thread is done downloading the url it calls this 
  *        function to find a new url to download if the function returns {"", -1}
  *        then there are no more urls to download and the downloader thread will
- *        exit.
+ *        exit. An empty list does not mean that yet, while another thread is
+ *        still working on a page that page can add new urls, so we wait until
+ *        either a url comes in or no page is being worked on anymore.
+ * 
+ *        Urls of a host whose circuit breaker is open are parked with the
+ *        host until the breaker lets a transfer through again, and dropped
+ *        if the host turns out to be dead. The breaker is only asked here,
+ *        the transfer itself admits the url when it starts.
  * 
+ * @param link Set if the url is a link that still has to be probed, its
+ *             depth is the one of the page that links to it.
  * @return pair<string, int> A pair of a url and its depth to be downloaded
  */
-pair<string, int> urlsmanager::get_url(void) {
-    std::lock_guard<std::mutex> lock(mutex);  // Lock to ensure thread safety
-
-    while (!url_depth_list.empty()) {
-        auto res = url_depth_list.front();
-        url_depth_list.pop_front();
-        if (res.second != 0) {
-            return res;
+pair<string, int> urlsmanager::get_url(bool& link) {
+    std::unique_lock<std::mutex> lock(lists_mutex);  // Lock to ensure thread safety
+
+    while (true) {
+        release_parked();
+        if (!ready_urls.empty()) {
+            parked_url res = ready_urls.front();
+            ready_urls.pop_front();
+            if (!ready_urls.empty()) {
+                lists_cv.notify_all();
+            }
+            busy_pages++;
+            link = res.link;
+            return {res.url, res.depth};
+        }
+        while (!url_depth_list.empty()) {
+            auto res = url_depth_list.front();
+            url_depth_list.pop_front();
+            if (res.second == 0) {
+                continue;
+            }
+            string host = url_host(res.first);
+            Admission admission = breakers.check(host);
+            if (admission == Admission::ALLOW) {
+                busy_pages++;
+                link = false;
+                return res;
+            } else if (admission == Admission::WAIT) {
+                parked_urls[host].push_back({res.first, res.second, false});
+            } else {
+                log(LogType::ERROR, "Host is down, skipping URL: " + res.first);
+            }
+        }
+        if (busy_pages == 0 && parked_urls.empty()) {
+            lists_cv.notify_all();
+            return {"", -1};
+        }
+        if (parked_urls.empty()) {
+            lists_cv.wait(lock);
+        } else {
+            // Look at the parked urls again once a breaker may let one through
+            auto next_retry = min(breakers.next_retry(), chrono::steady_clock::now() + chrono::seconds(1));
+            lists_cv.wait_until(lock, next_retry);
+        }
+    }
+}
+
+/**
+ * @brief Hands the parked urls of every host that is back to get_url. All
+ *        of them once its breaker closed, one while its breaker only lets
+ *        its half open transfer through. The urls of a dead host are dropped.
+ *        Called with lists_mutex held.
+ */
+void urlsmanager::release_parked() {
+    for (auto it = parked_urls.begin(); it != parked_urls.end();) {
+        Admission admission = breakers.check(it->first);
+        deque<parked_url>& urls = it->second;
+        if (admission == Admission::DEAD) {
+            for (const parked_url& parked : urls) {
+                log(LogType::ERROR, "Host is down, skipping URL: " + parked.url);
+            }
+            urls.clear();
+        } else if (admission == Admission::ALLOW && breakers.is_closed(it->first)) {
+            ready_urls.insert(ready_urls.end(), urls.begin(), urls.end());
+            urls.clear();
+        } else if (admission == Admission::ALLOW) {
+            ready_urls.push_back(urls.front());
+            urls.pop_front();
+        }
+        if (urls.empty()) {
+            it = parked_urls.erase(it);
+        } else {
+            ++it;
         }
     }
-    return {"", -1};
+}
+
+/**
+ * @brief Parks a page with its host, the downloader thread calls this when
+ *        the circuit breaker of the host does not let its transfer through
+ *        or opened before the page could be retried. It is downloaded once
+ *        the host is back.
+ */
+void urlsmanager::retry_url(const string& url, int depth) {
+    {
+        std::lock_guard<std::mutex> lock(lists_mutex);
+        parked_urls[url_host(url)].push_back({url, depth, false});
+    }
+    lists_cv.notify_one();
+}
+
+/**
+ * @brief Parks a claimed link whose probe has to wait for its host, it is
+ *        handed to a downloader thread to be probed once the host is back.
+ * 
+ * @param url   The canonical url of the link.
+ * @param depth The depth of the page that links to it.
+ */
+void urlsmanager::park_link(const string& url, int depth) {
+    {
+        std::lock_guard<std::mutex> lock(lists_mutex);
+        parked_urls[url_host(url)].push_back({url, depth, true});
+    }
+    lists_cv.notify_one();
+}
+
+/**
+ * @brief The downloader thread calls this after it is done with a url it got
+ *        from get_url, including adding the urls found on the page.
+ */
+void urlsmanager::finish_url(void) {
+    {
+        std::lock_guard<std::mutex> lock(lists_mutex);
+        busy_pages--;
+    }
+    lists_cv.notify_all();
 }
 
 /**
@@ -115,18 +325,124 @@ void urlsmanager::log(LogType type, const std::string& message) {
  */
 void urlsmanager::start() {
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (config.multiplex && !engine.start(config.streams_per_connection, config.connections_per_host)) {
+        log(LogType::ERROR, "Could not start the fetch engine, every thread runs its own transfers");
+    }
+    // Connections can only be shared by transfers that all run on the engine
+    if (config.share_caches && !shared.open(engine.is_running())) {
+        log(LogType::ERROR, "Could not share the DNS, TLS and connection caches between the transfers");
+    }
+    resolver.start(config.dns_threads, config.dns_ttl, config.dns_negative_ttl);
+    for (const auto& entry : url_depth_list) {
+        resolver.prefetch(entry.first);
+    }
 
     vector<downloader*> downloader_threads;
+    vector<downloader*> media_threads;
 
-    for(size_t i = 0; i < 4; i++) {
-        downloader downloader_thread(this);
-        downloader_threads.emplace_back(&downloader_thread);
+    // The downloaders are allocated on the heap because their threads keep
+    // using them after this loop, they are deleted once all of them are done.
+    for(int i = 0; i < config.downloader_threads; i++) {
+        downloader_threads.emplace_back(new downloader(this));
+    }
+    for (TrafficClass traffic : {TrafficClass::ASSETS, TrafficClass::MEDIA}) {
+        for (int i = 0; i < this->traffic.threads(traffic); i++) {
+            media_threads.emplace_back(new downloader(this, traffic));
+        }
+    }
+
+    // The media threads keep going until the pages cannot queue anything new
+    wait_for(downloader_threads);
+    traffic.finish_pages();
+    wait_for(media_threads);
+
+    for (downloader* dthread : downloader_threads) {
+        delete dthread;
+    }
+    for (downloader* dthread : media_threads) {
+        delete dthread;
+    }
+    pack.close();
+    warc.close();
+    writer.shutdown();
+    texts.close();
+    resolver.stop();
+    engine.stop();
+
+    if (!config.probe_cache_file.empty() && !probes.save(config.probe_cache_file)) {
+        log(LogType::ERROR, "Could not save the probe cache to " + config.probe_cache_file);
+    }
+    if (!config.recrawl_file.empty() && !recrawl.save(config.recrawl_file)) {
+        log(LogType::ERROR, "Could not save the recrawl index to " + config.recrawl_file);
+    }
+    if (!config.redirect_file.empty() && !redirects.save(config.redirect_file)) {
+        log(LogType::ERROR, "Could not save the redirects to " + config.redirect_file);
+    }
+    if (!config.hsts_file.empty() && !upgrades.save(config.hsts_file)) {
+        log(LogType::ERROR, "Could not save the https hosts to " + config.hsts_file);
     }
 
+    log(LogType::INFO, "Media store: " + to_string(media.stored_count()) + " new blobs, " +
+        to_string(media.duplicate_count()) + " duplicates of stored blobs");
+    report_throughput("last");
+    log(LogType::INFO, "Received: " + to_string(bandwidth.received(TrafficClass::HTML)) + " bytes of pages, " +
+        to_string(bandwidth.received(TrafficClass::ASSETS)) + " of assets, " +
+        to_string(bandwidth.received(TrafficClass::MEDIA)) + " of large media");
+    log(LogType::INFO, "Body caps: " + to_string(limits.truncated_count(BodyClass::PAGE)) + " pages, " +
+        to_string(limits.truncated_count(BodyClass::MEDIA)) + " media, " +
+        to_string(limits.truncated_count(BodyClass::PROBE)) + " probes truncated");
+    log(LogType::INFO, "Scheme upgrades: " + to_string(upgrades.size()) + " https hosts, " +
+        to_string(upgrades.upgraded_count()) + " links upgraded");
+    log(LogType::INFO, "Redirects: " + to_string(redirects.size()) + " known, " +
+        to_string(redirects.rewritten_count()) + " links rewritten to their target");
+    if (cache.is_open()) {
+        log(LogType::INFO, "HTTP cache: " + to_string(cache.hit_count()) + " hits, " +
+            to_string(cache.store_count()) + " stored, " + to_string(cache.eviction_count()) + " evicted");
+    }
+    if (!config.recrawl_file.empty()) {
+        log(LogType::INFO, "Recrawl: " + to_string(recrawl.unchanged_count()) + " pages not modified");
+    }
+    log(LogType::INFO, "Compression: " + to_string(bandwidth.received(TrafficClass::HTML)) +
+        " bytes of pages on the wire for " + to_string(bandwidth.decoded(TrafficClass::HTML)) + " bytes decoded");
+    log(LogType::INFO, "DNS pre-resolution: " + to_string(resolver.resolved_count()) + " hosts resolved, " +
+        to_string(resolver.failed_count()) + " failed, " + to_string(resolver.warm_count()) +
+        " transfers started on a resolved host");
+    log(LogType::INFO, "Connections: " + to_string(shared.reused_count()) + " of " +
+        to_string(shared.transfer_count()) + " transfers reused one");
+    if (config.multiplex) {
+        log(LogType::INFO, "Fetch engine: " + to_string(engine.transfer_count()) + " transfers, " +
+            to_string(engine.http2_count()) + " over HTTP/2, at most " +
+            to_string(engine.most_running_count()) + " at once");
+    }
+    log(LogType::INFO, "Circuit breakers: " + to_string(breakers.opened_count()) + " opened, " +
+        to_string(breakers.dead_count()) + " hosts given up");
+    log(LogType::INFO, "Host concurrency: " + to_string(hosts.increase_count()) + " increases, " +
+        to_string(hosts.decrease_count()) + " decreases");
+    log(LogType::INFO, "Traffic classes: " + to_string(traffic.queued_count(TrafficClass::ASSETS)) +
+        " assets, " + to_string(traffic.queued_count(TrafficClass::MEDIA)) + " large media downloaded in the background");
+
+    if (config.predict_types) {
+        log(LogType::INFO, "Content type predictor: " + to_string(predictor.hit_count()) + " hits, " +
+            to_string(predictor.miss_count()) + " misses, " +
+            to_string(predictor.misprediction_count()) + " mispredictions");
+    }
+
+    cout << "Done downloading the urls\n";
+
+    shared.close();
+    curl_global_cleanup();
+
+}
+
+/**
+ * @brief Waits until none of the given downloaders is downloading anymore.
+ */
+void urlsmanager::wait_for(const vector<downloader*>& downloaders) {
     bool downloading = false;
+    auto last_report = chrono::steady_clock::now();
 
     while(true) {
-        for (downloader* dthread : downloader_threads) {
+        for (downloader* dthread : downloaders) {
             downloading = downloading || dthread->is_downloading();
         }
         
@@ -134,11 +450,23 @@ void urlsmanager::start() {
             break;
         } else {
             downloading = false;
+            this_thread::sleep_for(chrono::milliseconds(10));
+
+            if (config.stats_interval > 0 &&
+                chrono::steady_clock::now() - last_report >= chrono::seconds(config.stats_interval)) {
+                report_throughput("current");
+                last_report = chrono::steady_clock::now();
+            }
         }
     }
+}
 
-    cout << "Done downloading the urls\n";
-
-    curl_global_cleanup();
-
+/**
+ * @brief Logs the throughput since the last report and since the start.
+ */
+void urlsmanager::report_throughput(const string& what) {
+    double current, average;
+    bandwidth.throughput(current, average);
+    log(LogType::INFO, "Throughput: " + to_string((long long)(current / 1024)) + " KiB/s " + what + ", " +
+        to_string((long long)(average / 1024)) + " KiB/s average");
 }
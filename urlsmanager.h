@@ -2,30 +2,94 @@
 #include <string>
 #include <vector>
 #include <deque>
+#include <unordered_set>
+#include <unordered_map>
 #include <algorithm>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include "logger.h"
+#include "crawlconfig.h"
+#include "typepredictor.h"
+#include "probecache.h"
+#include "diskwriter.h"
+#include "mediastore.h"
+#include "packfile.h"
+#include "warcwriter.h"
+#include "textlayout.h"
+#include "hostlimiter.h"
+#include "trafficclass.h"
+#include "bandwidthlimiter.h"
+#include "retrypolicy.h"
+#include "circuitbreaker.h"
+#include "curlshare.h"
+#include "dnsresolver.h"
+#include "recrawlindex.h"
+#include "httpcache.h"
+#include "redirectmap.h"
+#include "schemeupgrade.h"
+#include "fetchengine.h"
+#include "bodylimits.h"
 
 #ifndef _URLSMANAGER_H_
 #define _URLSMANAGER_H_
 
 using namespace std;
 
+class downloader;
+
 class urlsmanager {
 private:
+    // A page, or a link that is not probed yet, waiting for its host
+    struct parked_url {
+        string url;
+        int depth;
+        bool link;
+    };
     Logger* logger;
     deque<pair<string, int>> url_depth_list;
-    vector<string> visited_before;
+    unordered_map<string, deque<parked_url>> parked_urls;
+    deque<parked_url> ready_urls;
+    unordered_set<string> visited_before;
     thread url_manager_thread;
     mutex lists_mutex;
+    condition_variable lists_cv;
+    int busy_pages;
+    void release_parked();
+    void wait_for(const vector<downloader*>& downloaders);
+    void report_throughput(const string& what);
 public:
-    mutex curl_mutex;
-    urlsmanager(deque<pair<string, int>> url_list, Logger* logger);
+    crawl_config config;
+    type_predictor predictor;
+    probe_cache probes;
+    disk_writer writer;
+    media_store media;
+    pack_writer pack;
+    warc_writer warc;
+    text_layout texts;
+    host_limiter hosts;
+    traffic_classes traffic;
+    bandwidth_limiter bandwidth;
+    retry_policy retries;
+    host_breakers breakers;
+    curl_share shared;
+    dns_resolver resolver;
+    recrawl_index recrawl;
+    http_cache cache;
+    redirect_map redirects;
+    scheme_upgrades upgrades;
+    fetch_engine engine;
+    body_limits limits;
+    urlsmanager(deque<pair<string, int>> url_list, Logger* logger, const crawl_config& config);
     urlsmanager(const urlsmanager&);
     ~urlsmanager(void);
     void add_url(string& url, int depth);
-    pair<string, int> get_url(void);
+    vector<string> claim_unvisited(const vector<string>& urls);
+    void unclaim(const string& url);
+    pair<string, int> get_url(bool& link);
+    void finish_url(void);
+    void retry_url(const string& url, int depth);
+    void park_link(const string& url, int depth);
     void log(LogType type, const std::string& message);
     void start();
 };
@@ -0,0 +1,107 @@
+/**
+ * @file urlutil.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Small helpers for working with urls as plain strings. The same page
+ *         is usually linked in slightly different ways (upper case host names,
+ *         explicit default ports, #fragments that only scroll the page) so
+ *         before we compare urls against the ones we have already seen we
+ *         bring them to one canonical form with these helpers.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "urlutil.h"
+#include <algorithm>
+#include <cctype>
+
+/**
+ * @brief Brings a url to its canonical form; the scheme and host are lower
+ *        cased, the default port of the scheme is dropped, the fragment is
+ *        removed and an empty path becomes "/".
+ * 
+ * @param url The absolute url to canonicalize.
+ * @return string The canonical url, or the input unchanged if it has no scheme.
+ */
+string canonicalize_url(const string& url) {
+    size_t scheme_end = url.find("://");
+    if (scheme_end == string::npos) {
+        return url;
+    }
+
+    // Fragments never reach the server so they do not make a different url
+    string result = url.substr(0, url.find('#'));
+
+    size_t host_start = scheme_end + 3;
+    size_t path_start = result.find_first_of("/?", host_start);
+    if (path_start == string::npos) {
+        result += "/";
+        path_start = result.size() - 1;
+    } else if (result[path_start] == '?') {
+        result.insert(path_start, "/");
+    }
+
+    string scheme = result.substr(0, scheme_end);
+    string host = result.substr(host_start, path_start - host_start);
+    transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+    transform(host.begin(), host.end(), host.begin(), ::tolower);
+
+    if ((scheme == "http" && host.size() > 3 && host.compare(host.size() - 3, 3, ":80") == 0) ||
+        (scheme == "https" && host.size() > 4 && host.compare(host.size() - 4, 4, ":443") == 0)) {
+        host.erase(host.find_last_of(':'));
+    }
+
+    return scheme + "://" + host + result.substr(path_start);
+}
+
+/**
+ * @brief The key under which a url counts as visited. It is the canonical url
+ *        with https taken as http, a site serves the same pages over both so
+ *        the two forms of a link are one page.
+ * 
+ * @param url The absolute url.
+ * @return string The key of the url.
+ */
+string url_identity(const string& url) {
+    string canonical = canonicalize_url(url);
+    if (canonical.compare(0, 8, "https://") == 0) {
+        return "http://" + canonical.substr(8);
+    }
+    return canonical;
+}
+
+/**
+ * @brief Extracts the host (including the port if there is one) of a url.
+ * 
+ * @param url The absolute url.
+ * @return string The lower cased host or an empty string for relative urls.
+ */
+string url_host(const string& url) {
+    size_t scheme_end = url.find("://");
+    if (scheme_end == string::npos) {
+        return "";
+    }
+
+    size_t host_start = scheme_end + 3;
+    size_t host_end = url.find_first_of("/?#", host_start);
+    string host = url.substr(host_start, host_end == string::npos ? string::npos : host_end - host_start);
+    transform(host.begin(), host.end(), host.begin(), ::tolower);
+    return host;
+}
+
+/**
+ * @brief A 64 bit FNV-1a hash of the url, used to find urls in indexes
+ *        without storing or comparing the whole string first.
+ * 
+ * @param url The canonical url.
+ * @return uint64_t The fingerprint of the url.
+ */
+uint64_t url_fingerprint(const string& url) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : url) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,15 @@
+// urlutil.h
+#include <string>
+#include <cstdint>
+
+#ifndef _URLUTIL_H_
+#define _URLUTIL_H_
+
+using namespace std;
+
+string canonicalize_url(const string& url);
+string url_identity(const string& url);
+string url_host(const string& url);
+uint64_t url_fingerprint(const string& url);
+
+#endif
@@ -0,0 +1,404 @@
+/**
+ * @file warcwriter.cpp
+ * @author Faisal Abdelmonem
+ * @brief  Writes what we fetch to WARC/1.1 files so a crawl can be archived
+ *         without fetching everything a second time. While a transfer runs
+ *         a warc_capture collects the request headers libcurl sends and the
+ *         response headers and body as they come off the wire (bodies larger
+ *         than a few megabytes go to a temporary file in tmp/ instead of
+ *         memory, written by the disk writer pool like everything else).
+ *         When the transfer is done the writer appends a response record and
+ *         a request record for it to the current segment. The records are
+ *         compressed on the thread of the transfer and the compressed bytes
+ *         are handed to the disk writer pool, so only the pool waits for
+ *         the disk. Every record is
+ *         compressed on its own (one gzip member or one zstd frame per
+ *         record) so a reader can seek to any record without decompressing
+ *         the ones before it. A segment is closed and a new one started once
+ *         it grows past the maximum size, and each segment starts with a
+ *         warcinfo record describing the crawl.
+ *
+ *         libcurl hands us the body without the chunked transfer encoding,
+ *         so that header is renamed in the stored response to keep the
+ *         record consistent with the body that follows it.
+ * @date 2026-10-18
+ * 
+ * @copyright Copyright (c) 2026
+ * 
+ */
+
+#include "warcwriter.h"
+#include <filesystem>
+#include <random>
+#include <future>
+#include <ctime>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+
+namespace fs = filesystem;
+
+// Bodies larger than this are kept in a temporary file while they stream in
+static const size_t MAX_PAYLOAD_IN_MEMORY = 4 << 20;
+
+/**
+ * @brief Returns a new random (version 4) uuid for a WARC-Record-ID.
+ */
+static string record_id() {
+    static thread_local mt19937_64 generator(random_device{}());
+    uint64_t high = generator(), low = generator();
+    high = (high & 0xffffffffffff0fffULL) | 0x0000000000004000ULL;
+    low = (low & 0x3fffffffffffffffULL) | 0x8000000000000000ULL;
+    char uuid[48];
+    snprintf(uuid, sizeof(uuid), "<urn:uuid:%08x-%04x-%04x-%04x-%012llx>",
+             (unsigned)(high >> 32), (unsigned)((high >> 16) & 0xffff), (unsigned)(high & 0xffff),
+             (unsigned)(low >> 48), (unsigned long long)(low & 0xffffffffffffULL));
+    return uuid;
+}
+
+/**
+ * @brief Returns the current time in the format WARC-Date wants.
+ */
+static string warc_date() {
+    time_t now = time(nullptr);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    return date;
+}
+
+/**
+ * @brief Construct a new warc_capture object for a transfer of the given url.
+ * 
+ * @param writer     The disk writer pool a large body is spilled with.
+ * @param spill_path Where a large body is spilled, see warc_writer::spill_path.
+ */
+warc_capture::warc_capture(const string& url, disk_writer* writer, const string& spill_path):
+    writer(writer), spill_path(spill_path), spill(nullptr), spilled(nullptr), spill_size(0), url(url),
+    truncated(false) {}
+
+warc_capture::~warc_capture() {
+    if (spill) {
+        writer->discard(spill);
+    } else if (spilled) {
+        fclose(spilled);
+        ::unlink(spill_path.c_str());
+    }
+}
+
+/**
+ * @brief Adds a header line libcurl sent, called from the debug callback.
+ */
+void warc_capture::add_request_header(const char* data, size_t size) {
+    // A redirect or a retry sends a new request, keep the last one
+    if (size >= 4 && memcmp(data, "GET ", 4) == 0) {
+        request_headers.clear();
+    }
+    request_headers.append(data, size);
+}
+
+/**
+ * @brief Adds a response header line, called from the header callback. The
+ *        chunked transfer encoding header is renamed since the stored body
+ *        is not chunked anymore.
+ */
+void warc_capture::add_response_header(const char* data, size_t size) {
+    // Every response (after a redirect or a 100 Continue) starts a new block
+    if (size >= 5 && memcmp(data, "HTTP/", 5) == 0) {
+        response_headers.clear();
+    }
+    if (size >= 18 && strncasecmp(data, "Transfer-Encoding:", 18) == 0) {
+        response_headers += "X-Crawler-";
+    }
+    response_headers.append(data, size);
+}
+
+/**
+ * @brief Adds a chunk of the body, called from the write callback.
+ * 
+ * @param wait false on the fetch engine thread, see disk_writer::write.
+ */
+void warc_capture::add_payload(const void* data, size_t size, bool wait) {
+    if (!spill && payload.size() + size > MAX_PAYLOAD_IN_MEMORY) {
+        spill = writer->open(spill_path);
+        writer->write(spill, payload.data(), payload.size(), wait);
+        spill_size = payload.size();
+        payload.clear();
+        payload.shrink_to_fit();
+    }
+    if (spill) {
+        writer->write(spill, data, size, wait);
+        spill_size += size;
+    } else {
+        payload.append((const char*)data, size);
+    }
+}
+
+/**
+ * @brief Waits until a spilled body is on disk and opens it to be read,
+ *        called on the thread of the transfer once it is done.
+ * 
+ * @return false if the body could not be spilled.
+ */
+bool warc_capture::finish_payload() {
+    if (!spill) {
+        return true;
+    }
+    promise<bool> written;
+    future<bool> result = written.get_future();
+    writer->close(spill, "", [&written](bool ok) { written.set_value(ok); });
+    spill = nullptr;
+    bool ok = result.get();
+    if (ok) {
+        spilled = fopen(spill_path.c_str(), "rb");
+    }
+    if (!spilled) {
+        ::unlink(spill_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the size of the body captured so far.
+ */
+size_t warc_capture::payload_size() {
+    return spill || spilled ? spill_size : payload.size();
+}
+
+/**
+ * @brief Construct a new warc_writer object, nothing is written until open
+ *        is called.
+ */
+warc_writer::warc_writer(): compression(WarcCompression::GZIP), max_segment_size(0), writer(nullptr),
+    segment(nullptr), segment_size(0), segment_number(0), spill_number(0) {
+#ifdef HAVE_ZSTD
+    zstd_stream = nullptr;
+#endif
+}
+
+warc_writer::~warc_writer() {
+    close();
+}
+
+/**
+ * @brief Opens the writer, the first segment is created right away.
+ * 
+ * @param directory        Where the segments are written.
+ * @param compression      How every record is compressed.
+ * @param max_segment_size Size after which a new segment is started.
+ * @param writer           The disk writer pool the segments are written with.
+ * @return true if the first segment could be created.
+ * @return false otherwise, or if zstd was asked for but not compiled in.
+ */
+bool warc_writer::open(const string& directory, WarcCompression compression, uint64_t max_segment_size,
+                       disk_writer* writer) {
+    lock_guard<mutex> lock(warc_mutex);
+#ifndef HAVE_ZSTD
+    if (compression == WarcCompression::ZSTD) {
+        return false;
+    }
+#else
+    zstd_stream = ZSTD_createCStream();
+#endif
+    this->directory = directory;
+    this->compression = compression;
+    this->max_segment_size = max_segment_size;
+    this->writer = writer;
+
+    time_t now = time(nullptr);
+    char stamp[16];
+    strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", gmtime(&now));
+    run_id = stamp;
+
+    // Bodies a crash left spilled are of no use anymore
+    error_code ec;
+    fs::remove_all(directory + "/tmp", ec);
+    fs::create_directories(directory + "/tmp", ec);
+    if (ec) {
+        return false;
+    }
+    return open_segment();
+}
+
+/**
+ * @brief A new path a capture can spill a large body to.
+ */
+string warc_writer::spill_path() {
+    return directory + "/tmp/" + run_id + "-" + to_string(spill_number++) + ".payload";
+}
+
+bool warc_writer::open_segment() {
+    if (segment) {
+        writer->close(segment);
+    }
+
+    const char* extension = compression == WarcCompression::GZIP ? ".warc.gz" :
+                            compression == WarcCompression::ZSTD ? ".warc.zst" : ".warc";
+    char number[16];
+    snprintf(number, sizeof(number), "-%05u", segment_number++);
+    string file_name = "crawl-" + run_id + number + extension;
+
+    segment = writer->open(directory + "/" + file_name);
+    segment_size = 0;
+
+    string info = "software: downloadingApplication\r\nformat: WARC File Format 1.1\r\n";
+    string header = "WARC/1.1\r\n"
+                    "WARC-Type: warcinfo\r\n"
+                    "WARC-Record-ID: " + record_id() + "\r\n"
+                    "WARC-Date: " + warc_date() + "\r\n"
+                    "WARC-Filename: " + file_name + "\r\n"
+                    "Content-Type: application/warc-fields\r\n"
+                    "Content-Length: " + to_string(info.size()) + "\r\n\r\n";
+    return write_record(header, nullptr, info);
+}
+
+void warc_writer::begin_member() {
+    if (compression == WarcCompression::GZIP) {
+        memset(&gzip_stream, 0, sizeof(gzip_stream));
+        // 31 window bits asks zlib for a gzip header instead of a zlib one
+        deflateInit2(&gzip_stream, Z_BEST_SPEED, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+    }
+#ifdef HAVE_ZSTD
+    if (compression == WarcCompression::ZSTD) {
+        ZSTD_initCStream(zstd_stream, 3);
+    }
+#endif
+}
+
+/**
+ * @brief Compresses (or copies) a piece of the current record into the
+ *        segment. A null data with size 0 finishes the record.
+ */
+bool warc_writer::write_member(const char* data, size_t size) {
+    char out[1 << 16];
+
+    if (compression == WarcCompression::GZIP) {
+        int flush = data ? Z_NO_FLUSH : Z_FINISH;
+        gzip_stream.next_in = (Bytef*)data;
+        gzip_stream.avail_in = size;
+        int status;
+        do {
+            gzip_stream.next_out = (Bytef*)out;
+            gzip_stream.avail_out = sizeof(out);
+            status = deflate(&gzip_stream, flush);
+            size_t produced = sizeof(out) - gzip_stream.avail_out;
+            writer->write(segment, out, produced);
+            segment_size += produced;
+        } while (gzip_stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+        return true;
+    }
+#ifdef HAVE_ZSTD
+    if (compression == WarcCompression::ZSTD) {
+        ZSTD_inBuffer input = {data, size, 0};
+        ZSTD_EndDirective mode = data ? ZSTD_e_continue : ZSTD_e_end;
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = {out, sizeof(out), 0};
+            remaining = ZSTD_compressStream2(zstd_stream, &output, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                return false;
+            }
+            writer->write(segment, out, output.pos);
+            segment_size += output.pos;
+        } while (mode == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+        return true;
+    }
+#endif
+    if (!data) {
+        return true;
+    }
+    segment_size += size;
+    writer->write(segment, data, size);
+    return true;
+}
+
+bool warc_writer::end_member() {
+    bool ok = write_member(nullptr, 0);
+    if (compression == WarcCompression::GZIP) {
+        deflateEnd(&gzip_stream);
+    }
+    return ok;
+}
+
+/**
+ * @brief Writes one record: its WARC header, its block (the http headers
+ *        given in block followed by the captured body, if any) and the two
+ *        line breaks that end every record, as one compressed member.
+ */
+bool warc_writer::write_record(const string& header, warc_capture* capture, const string& block) {
+    begin_member();
+    bool ok = write_member(header.data(), header.size()) && write_member(block.data(), block.size());
+    if (ok && capture) {
+        ok = capture->for_each_payload_chunk([this](const char* data, size_t size) {
+            return write_member(data, size);
+        });
+    }
+    ok = write_member("\r\n\r\n", 4) && ok;
+    return end_member() && ok;
+}
+
+/**
+ * @brief Appends the response record and the request record of a finished
+ *        transfer. Starts a new segment first if the current one is full.
+ * 
+ * @param capture What was captured during the transfer.
+ * @return true if both records were handed to the disk writer.
+ * @return false otherwise.
+ */
+bool warc_writer::write_transaction(warc_capture& capture) {
+    if (!capture.finish_payload()) {
+        return false;
+    }
+    lock_guard<mutex> lock(warc_mutex);
+    if (!segment || capture.response_headers.empty()) {
+        return false;
+    }
+    if (segment_size >= max_segment_size && !open_segment()) {
+        return false;
+    }
+
+    string date = warc_date();
+    string response_id = record_id();
+    string ip = capture.ip.empty() ? "" : "WARC-IP-Address: " + capture.ip + "\r\n";
+    // The body was cut off at the size cap of its class
+    string truncated = capture.truncated ? "WARC-Truncated: length\r\n" : "";
+
+    string response_header = "WARC/1.1\r\n"
+                             "WARC-Type: response\r\n"
+                             "WARC-Record-ID: " + response_id + "\r\n"
+                             "WARC-Date: " + date + "\r\n"
+                             "WARC-Target-URI: " + capture.url + "\r\n" + ip + truncated +
+                             "Content-Type: application/http;msgtype=response\r\n"
+                             "Content-Length: " + to_string(capture.response_headers.size() + capture.payload_size()) + "\r\n\r\n";
+    bool ok = write_record(response_header, &capture, capture.response_headers);
+
+    if (!capture.request_headers.empty()) {
+        string request_header = "WARC/1.1\r\n"
+                                "WARC-Type: request\r\n"
+                                "WARC-Record-ID: " + record_id() + "\r\n"
+                                "WARC-Date: " + date + "\r\n"
+                                "WARC-Target-URI: " + capture.url + "\r\n"
+                                "WARC-Concurrent-To: " + response_id + "\r\n" + ip +
+                                "Content-Type: application/http;msgtype=request\r\n"
+                                "Content-Length: " + to_string(capture.request_headers.size()) + "\r\n\r\n";
+        ok = write_record(request_header, nullptr, capture.request_headers) && ok;
+    }
+    return ok;
+}
+
+/**
+ * @brief Closes the current segment.
+ */
+void warc_writer::close() {
+    lock_guard<mutex> lock(warc_mutex);
+    if (segment) {
+        writer->close(segment);
+        segment = nullptr;
+    }
+#ifdef HAVE_ZSTD
+    if (zstd_stream) {
+        ZSTD_freeCStream(zstd_stream);
+        zstd_stream = nullptr;
+    }
+#endif
+}
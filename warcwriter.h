@@ -0,0 +1,96 @@
+// warcwriter.h
+#include <string>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <zlib.h>
+#include "diskwriter.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef _WARCWRITER_H_
+#define _WARCWRITER_H_
+
+using namespace std;
+
+enum class WarcCompression {
+    NONE,
+    GZIP,
+    ZSTD
+};
+
+class warc_capture {
+private:
+    disk_writer* writer;
+    string spill_path;
+    disk_file* spill;
+    FILE* spilled;
+    size_t spill_size;
+public:
+    string url;
+    string ip;
+    string request_headers;
+    string response_headers;
+    string payload;
+    bool truncated;
+    warc_capture(const string& url, disk_writer* writer, const string& spill_path);
+    ~warc_capture();
+    void add_request_header(const char* data, size_t size);
+    void add_response_header(const char* data, size_t size);
+    void add_payload(const void* data, size_t size, bool wait = true);
+    bool finish_payload();
+    size_t payload_size();
+    template <typename F> bool for_each_payload_chunk(F f);
+};
+
+class warc_writer {
+private:
+    string directory;
+    WarcCompression compression;
+    uint64_t max_segment_size;
+    disk_writer* writer;
+    disk_file* segment;
+    uint64_t segment_size;
+    uint32_t segment_number;
+    atomic<uint64_t> spill_number;
+    string run_id;
+    mutex warc_mutex;
+    z_stream gzip_stream;
+#ifdef HAVE_ZSTD
+    ZSTD_CStream* zstd_stream;
+#endif
+    bool open_segment();
+    void begin_member();
+    bool write_member(const char* data, size_t size);
+    bool end_member();
+    bool write_record(const string& header, warc_capture* capture, const string& block);
+public:
+    warc_writer();
+    ~warc_writer();
+    bool open(const string& directory, WarcCompression compression, uint64_t max_segment_size,
+              disk_writer* writer);
+    bool is_open() { return segment != nullptr; }
+    string spill_path();
+    bool write_transaction(warc_capture& capture);
+    void close();
+};
+
+template <typename F>
+bool warc_capture::for_each_payload_chunk(F f) {
+    if (!spilled) {
+        return f(payload.data(), payload.size());
+    }
+    char buffer[1 << 16];
+    rewind(spilled);
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), spilled)) > 0) {
+        if (!f(buffer, got)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif